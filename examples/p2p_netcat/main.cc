@@ -6,6 +6,8 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <future>
 #include <thread>
 #include <iostream>
 #include <string>
@@ -121,18 +123,30 @@ int main(int argc, char *argv[]) {
 
 void read_stdin(Peer* peer, std::string peer_id)
 {
+  // Keep several reads in flight instead of waiting a round-trip per read
+  const size_t max_inflight = 16;
+
   int nbytes;
   char buf[32*1024];
+  std::deque<std::future<bool>> inflight;
 
   for (;;) {
     nbytes = read(STDIN_FILENO, buf, sizeof(buf));
     if (nbytes <= 0) {
+      while (!inflight.empty()) {
+        inflight.front().wait();
+        inflight.pop_front();
+      }
       peer->Close( peer_id );
       return;
     }
 
-    if (!peer->Send(peer_id, buf, nbytes, SYNC_ON)) {
-      return;
+    inflight.push_back(peer->SendAsync(peer_id, buf, nbytes));
+
+    if (inflight.size() >= max_inflight) {
+      bool sent = inflight.front().get();
+      inflight.pop_front();
+      if (!sent) return;
     }
   }
 }
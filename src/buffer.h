@@ -0,0 +1,55 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#ifndef __PEERAPI_BUFFER_H__
+#define __PEERAPI_BUFFER_H__
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "rtc_base/copy_on_write_buffer.h"
+
+namespace peerapi {
+
+//
+// class Buffer
+//
+// A ref-counted payload. Copying a Buffer shares the underlying memory, so
+// one payload can be handed to the data channels of many peers without
+// copying its bytes again.
+//
+
+class Buffer {
+public:
+  Buffer() = default;
+  Buffer( const char* data, const std::size_t size ) : buffer_( data, size ) {}
+  explicit Buffer( const std::string& data ) : buffer_( data.data(), data.size() ) {}
+  explicit Buffer( const std::size_t size ) : buffer_( size ) {}
+  explicit Buffer( rtc::CopyOnWriteBuffer buffer ) : buffer_( std::move( buffer ) ) {}
+
+  Buffer( const Buffer& ) = default;
+  Buffer( Buffer&& ) = default;
+  Buffer& operator=( const Buffer& ) = default;
+  Buffer& operator=( Buffer&& ) = default;
+
+  // Writing through a shared buffer detaches it, so fill a Buffer before
+  // handing it to Send().
+  char* data() { return buffer_.data<char>(); }
+  const char* data() const { return buffer_.data<char>(); }
+  std::size_t size() const { return buffer_.size(); }
+  bool empty() const { return buffer_.size() == 0; }
+  void SetSize( const std::size_t size ) { buffer_.SetSize( size ); }
+
+  const rtc::CopyOnWriteBuffer& rtc_buffer() const { return buffer_; }
+
+private:
+  rtc::CopyOnWriteBuffer buffer_;
+};
+
+} // namespace peerapi
+
+#endif // __PEERAPI_BUFFER_H__
@@ -8,6 +8,14 @@
 #ifndef __PEERAPI_COMMON_H__
 #define __PEERAPI_COMMON_H__
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace peerapi {
 
 #define function_peer [&]
@@ -23,6 +31,163 @@ enum CloseCode {
   CLOSE_SIGNAL_ERROR
 };
 
+enum SendResult {
+  // Success
+  SEND_OK             = 0,
+
+  // Failure
+  SEND_WOULD_BLOCK,   // Send buffer of the peer is full, try again later
+  SEND_FAILED         // Peer is not connected or data channel refused data
+};
+
+using SendResults = std::map<std::string, SendResult>;
+using PeerFilter  = std::function<bool( const std::string& )>;
+using SendCallback = std::function<void( bool )>;
+
+
+//
+// struct PeerStats
+//
+// Transport statistics of a remote peer. Message and byte counters sum all
+// data channels of the peer. Candidate types are those of the selected
+// candidate pair, one of "host", "srflx", "prflx" or "relay".
+//
+
+struct PeerStats {
+  std::string peer_id_;
+  uint32_t messages_sent_ = 0;
+  uint32_t messages_received_ = 0;
+  uint64_t bytes_sent_ = 0;
+  uint64_t bytes_received_ = 0;
+  uint64_t buffered_amount_ = 0;
+  double round_trip_time_ = 0;          // Milliseconds, 0 until measured
+  std::string local_candidate_type_;
+  std::string remote_candidate_type_;
+  std::string local_address_;           // "ip:port" of the selected pair
+  std::string remote_address_;
+  int64_t connect_time_ = 0;            // Milliseconds to open the peer, with ICE and DTLS
+};
+
+using StatsCallback = std::function<void( bool, const PeerStats& )>;
+
+
+//
+// What a queued receive does when the receive queue is full
+//
+
+enum ReceiveOverflow {
+  RECEIVE_DROP        = 0,  // Drop the message received
+  RECEIVE_BLOCK,            // Wait on the WebRTC thread until Poll() makes room, or drop
+  RECEIVE_CLOSE             // Drop the message and close the peer
+};
+
+
+//
+// class PeerHandle
+//
+// A ref-counted id of a remote peer. It is made once for each peer
+// connection, so passing it to message handlers never copies the id.
+//
+
+class PeerHandle {
+public:
+  PeerHandle() = default;
+  explicit PeerHandle( const std::string& id ) : id_( std::make_shared<const std::string>( id ) ) {}
+
+  const std::string& id() const {
+    static const std::string empty;
+    return id_ ? *id_ : empty;
+  }
+
+  bool operator==( const PeerHandle& other ) const { return id_ == other.id_ || id() == other.id(); }
+  bool operator!=( const PeerHandle& other ) const { return !( *this == other ); }
+
+private:
+  std::shared_ptr<const std::string> id_;
+};
+
+
+//
+// struct ChannelSetting
+//
+// A data channel opened to every peer besides the default one. Sending on
+// a channel of its own keeps a bulk transfer from blocking small messages.
+// Channels with stripe_ set carry the chunks of SendStriped().
+//
+// A channel is reliable and ordered by default. An unordered channel does
+// not hold a message back for an earlier lost one, and a partially reliable
+// channel gives up on a message after max_retransmits_ retransmissions or
+// max_retransmit_time_ milliseconds. -1 leaves a limit unset.
+//
+
+struct ChannelSetting {
+  std::string name_;
+  bool stripe_ = false;
+  bool ordered_ = true;
+  int max_retransmits_ = -1;
+  int max_retransmit_time_ = -1;
+};
+
+using ChannelSettings = std::vector<ChannelSetting>;
+
+
+//
+// struct IceSetting
+//
+// ICE servers and policies of every peer connection. The host_only_ mode
+// gathers host candidates only, with no server and no TCP candidates, which
+// connects at once on a LAN or loopback instead of waiting for STUN.
+//
+// A peer losing its ICE connection is closed at once if restart_grace_ is
+// 0. Otherwise the peer that made the first offer restarts ICE after
+// restart_grace_ milliseconds, and the peer is closed if it is not connected
+// again within twice that time.
+//
+
+enum IceTransportPolicy {
+  ICE_TRANSPORT_ALL   = 0,
+  ICE_TRANSPORT_NOHOST,
+  ICE_TRANSPORT_RELAY
+};
+
+struct IceServerSetting {
+  std::vector<std::string> urls_;
+  std::string username_;
+  std::string credential_;
+};
+
+struct IceSetting {
+  std::vector<IceServerSetting> servers_ = { { { "stun:stun.l.google.com:19302" }, "", "" } };
+  IceTransportPolicy transport_policy_ = ICE_TRANSPORT_ALL;
+  int candidate_pool_size_ = 0;
+  bool continual_gathering_ = false;
+  bool host_only_ = false;
+  int restart_grace_ = 0;
+};
+
+
+//
+// struct SignalCompressionSetting
+//
+// permessage-deflate of the connection to the signal server, used if the
+// server agrees to it. SDP and ICE candidates compress well, so connection
+// setup sends fewer bytes, at a little CPU and the memory of one zlib stream
+// each way. Window bits are 9 to 15 and the memory level 1 to 9.
+//
+// With no context takeover a message is compressed on its own. It saves the
+// memory of the window between messages, but an answer no longer refers to
+// the offer sent before it.
+//
+
+struct SignalCompressionSetting {
+  bool enabled_ = false;
+  int client_max_window_bits_ = 15;           // Window of messages sent
+  int server_max_window_bits_ = 15;           // Window asked of the server
+  int memory_level_ = 4;                      // zlib memory of the compressor
+  bool client_no_context_takeover_ = false;
+  bool server_no_context_takeover_ = false;
+};
+
 
 const bool SYNC_OFF = false;
 const bool SYNC_ON = true;
@@ -30,6 +195,52 @@ const bool SYNC_ON = true;
 const bool FORCE_QUEUING_OFF = false;
 const bool FORCE_QUEUING_ON = true;
 
+// Send() returns SEND_WOULD_BLOCK once the data channel buffers more than the
+// high watermark, and 'writable' is emitted when it drains below the low one.
+const uint64_t DEFAULT_SEND_HIGH_WATERMARK = 16 * 1024 * 1024;
+const uint64_t DEFAULT_SEND_LOW_WATERMARK = 1 * 1024 * 1024;
+
+// SendStriped() splits data into chunks of this size, one per stripe channel
+// in turn. A chunk and its header must fit in one SCTP message.
+const std::size_t DEFAULT_STRIPE_CHUNK_SIZE = 64 * 1024;
+const std::size_t MAX_STRIPE_CHUNK_SIZE = 256 * 1024 - 64;
+
+// SendStriped() sends messages of at most this size. A peer receives as many
+// chunks of its own stripe_chunk_size as this needs, so peers sending large
+// striped messages use the same chunk size.
+const std::size_t MAX_STRIPE_MESSAGE_SIZE = 256 * 1024 * 1024;
+
+// Local ICE candidates gathered within this many milliseconds are sent in
+// one 'ice_candidate' command. 0 sends every candidate as it is gathered.
+const int DEFAULT_CANDIDATE_BATCH_DELAY = 0;
+const int MAX_CANDIDATE_BATCH_DELAY = 1000;
+
+// Peer connections created ahead of offers and answers, with candidates
+// already gathered. 0 creates a peer connection for each remote peer.
+const std::size_t DEFAULT_PEER_POOL_SIZE = 0;
+const std::size_t MAX_PEER_POOL_SIZE = 64;
+
+// A lost connection to the signal server is retried this many times, the
+// first after DEFAULT_SIGNAL_RECONNECT_DELAY milliseconds and each next one
+// 1.5 times later, up to DEFAULT_SIGNAL_RECONNECT_DELAY_MAX.
+const int DEFAULT_SIGNAL_RECONNECT_ATTEMPTS = 3;
+const int DEFAULT_SIGNAL_RECONNECT_DELAY = 5000;
+const int DEFAULT_SIGNAL_RECONNECT_DELAY_MAX = 25000;
+
+// A "stats" event is emitted for every open peer this often in milliseconds.
+// 0 emits no event, and stats are still read by Peer::GetStats().
+const int DEFAULT_STATS_INTERVAL = 0;
+
+// Received messages are queued for Peer::Poll() instead of emitted on the
+// WebRTC thread if the queue size is not 0.
+const std::size_t DEFAULT_RECEIVE_QUEUE_SIZE = 0;
+const std::size_t MAX_RECEIVE_QUEUE_SIZE = 1024 * 1024;
+
+// With RECEIVE_BLOCK the WebRTC thread waits this many milliseconds at most
+// for Poll() to make room. The message is dropped then, and so are the next
+// ones without waiting until the queue has room again.
+const int RECEIVE_BLOCK_TIMEOUT = 1000;
+
 } // namespace peerapi
 
 #endif // __PEERAPI_COMMON_H__
\ No newline at end of file
@@ -4,13 +4,16 @@
 *  Ryan Lee
 */
 
+#include <algorithm>
+#include <thread>
+
 #include "control.h"
 #include "peer.h"
 
 #include "rtc_base/location.h"
 // #include "rtc_base/strings/json.h"
 #include "rtc_base/thread.h"
-#include "api/create_peerconnection_factory.h"
+#include "rtc_base/time_utils.h"
 // #include "sdk/media_constraints.h"
 
 #include "logging.h"
@@ -31,12 +34,70 @@ namespace rtc {
 
 namespace peerapi {
 
+namespace {
+
+// Freed messages kept for each type of message. Enough for a burst of
+// signaling commands, such as many peers joining at once.
+const std::size_t kMaxFreeMessages = 256;
+
+} // namespace
+
+
+//
+// Free list of messages
+//
+
+MessageFreeList::MessageFreeList(std::size_t block_size)
+    : block_size_(block_size) {
+  blocks_.reserve(kMaxFreeMessages);
+}
+
+void* MessageFreeList::Allocate(std::size_t size) {
+  if (size == block_size_) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!blocks_.empty()) {
+      void* block = blocks_.back();
+      blocks_.pop_back();
+      return block;
+    }
+  }
+
+  return ::operator new(std::max(size, block_size_));
+}
+
+void MessageFreeList::Free(void* block) {
+  if (block == nullptr) return;
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (blocks_.size() < kMaxFreeMessages) {
+      blocks_.push_back(block);
+      return;
+    }
+  }
+
+  ::operator delete(block);
+}
+
+
 Control::Control()
        : Control(nullptr){
 }
 
 Control::Control(std::shared_ptr<Signal> signal)
-       : signal_(signal) {
+       : signal_(signal),
+         send_high_watermark_(DEFAULT_SEND_HIGH_WATERMARK),
+         send_low_watermark_(DEFAULT_SEND_LOW_WATERMARK),
+         dedicated_threads_(false),
+         shared_factory_(false),
+         stripe_chunk_size_(DEFAULT_STRIPE_CHUNK_SIZE),
+         candidate_batch_delay_(DEFAULT_CANDIDATE_BATCH_DELAY),
+         peer_pool_size_(DEFAULT_PEER_POOL_SIZE),
+         stats_interval_(DEFAULT_STATS_INTERVAL),
+         receive_overflow_(RECEIVE_DROP),
+         receive_overflowed_(false),
+         close_requested_(false),
+         channel_created_(false) {
 
   signal_->SignalOnCommandReceived_.connect(this, &Control::OnSignalCommandReceived);
   signal_->SignalOnClosed_.connect(this, &Control::OnSignalConnectionClosed);
@@ -80,8 +141,9 @@ bool Control::InitializeControl() {
 void Control::DeleteControl() {
   LOG_F( INFO ) << "Starting";
 
+  peer_pool_.clear();
   peer_connection_factory_ = NULL;
-  fake_audio_capture_module_ = NULL;
+  factory_.reset();
 
   LOG_F( INFO ) << "Done";
 }
@@ -131,21 +193,28 @@ void Control::Close(const CloseCode code, bool force_queuing) {
 
   LOG_F( INFO ) << "Call";
 
+  // Before queuing, the WebRTC thread may be waiting on a full receive queue
+  close_requested_ = true;
+
   //
   // Verify current thread
   //
 
   if (force_queuing || webrtc_thread_ != rtc::Thread::Current()) {
-    ControlMessageData *data = new ControlMessageData(code, ref_);
+    CloseMessage *data = new CloseMessage(code, ref_);
     webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_CLOSE, data);
     LOG_F( INFO ) << "Queued";
     return;
   }
 
   //
-  // Close peers
+  // Close peers, and stop refilling the pool and emitting stats
   //
 
+  peer_pool_size_ = 0;
+  stats_interval_ = 0;
+  peer_pool_.clear();
+
   std::vector<string> peer_ids;
 
   for (auto peer : peers_) {
@@ -179,8 +248,7 @@ void Control::ClosePeer( const string peer_id, const CloseCode code, bool force_
   //
 
   if (force_queuing || webrtc_thread_ != rtc::Thread::Current()) {
-    ControlMessageData *data = new ControlMessageData(peer_id, ref_);
-    data->data_int32_ = code;
+    PeerCloseMessage *data = new PeerCloseMessage(PeerCloseData{ peer_id, code }, ref_);
     webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_CLOSE_PEER, data);
     return;
   }
@@ -208,25 +276,190 @@ void Control::ClosePeer( const string peer_id, const CloseCode code, bool force_
 // Send data to peer
 //
 
-void Control::Send(const string to, const char* data, const size_t size) {
+void Control::Send(const string to, const rtc::CopyOnWriteBuffer& data) {
 
   typedef std::map<string, rtc::scoped_refptr<PeerControl>>::iterator it_type;
 
   it_type it = peers_.find(to);
   if (it == peers_.end()) return;
 
-  it->second->Send(data, size);
+  it->second->Send(data);
   return;
 }
 
-bool Control::SyncSend(const string to, const char* data, const size_t size) {
+bool Control::SyncSend(const string to, const rtc::CopyOnWriteBuffer& data) {
 
   typedef std::map<string, rtc::scoped_refptr<PeerControl>>::iterator it_type;
 
   it_type it = peers_.find(to);
   if (it == peers_.end()) return false;
 
-  return it->second->SyncSend(data, size);
+  return it->second->SyncSend(data);
+}
+
+SendResult Control::TrySend(const string to, const rtc::CopyOnWriteBuffer& data) {
+
+  auto it = peers_.find(to);
+  if (it == peers_.end()) return SEND_FAILED;
+
+  return it->second->TrySend(data);
+}
+
+void Control::SendAsync(const string to, const rtc::CopyOnWriteBuffer& data, SendCallback callback) {
+
+  auto it = peers_.find(to);
+  if (it == peers_.end()) {
+    if (callback) callback(false);
+    return;
+  }
+
+  it->second->SendAsync(data, std::move(callback));
+}
+
+//
+// Send data on a named channel of the peer
+//
+
+SendResult Control::TrySend(const string to, const string& channel, const rtc::CopyOnWriteBuffer& data) {
+
+  auto it = peers_.find(to);
+  if (it == peers_.end()) return SEND_FAILED;
+
+  return it->second->TrySend(channel, data);
+}
+
+void Control::SendAsync(const string to, const string& channel, const rtc::CopyOnWriteBuffer& data, SendCallback callback) {
+
+  auto it = peers_.find(to);
+  if (it == peers_.end()) {
+    if (callback) callback(false);
+    return;
+  }
+
+  it->second->SendAsync(channel, data, std::move(callback));
+}
+
+void Control::SendStriped(const string to, const rtc::CopyOnWriteBuffer& data, SendCallback callback) {
+
+  auto it = peers_.find(to);
+  if (it == peers_.end()) {
+    if (callback) callback(false);
+    return;
+  }
+
+  it->second->SendStriped(data, std::move(callback));
+}
+
+//
+// A fan-out walks peers_, which is changed on the WebRTC thread only, so it
+// runs there. Every peer sent to has a result, and a peer that is not open
+// or not known fails with SEND_FAILED.
+//
+
+SendResults Control::Broadcast(const rtc::CopyOnWriteBuffer& data, const PeerFilter& filter) {
+  if (webrtc_thread_ != rtc::Thread::Current()) {
+    return webrtc_thread_->Invoke<SendResults>(RTC_FROM_HERE, [&] {
+      return Broadcast(data, filter);
+    });
+  }
+
+  SendResults results;
+
+  for (auto& peer : peers_) {
+    if (filter && !filter(peer.first)) continue;
+    results[peer.first] = peer.second->TrySend(data);
+  }
+
+  return results;
+}
+
+SendResults Control::Multicast(const std::vector<string>& peer_ids, const rtc::CopyOnWriteBuffer& data) {
+  if (webrtc_thread_ != rtc::Thread::Current()) {
+    return webrtc_thread_->Invoke<SendResults>(RTC_FROM_HERE, [&] {
+      return Multicast(peer_ids, data);
+    });
+  }
+
+  SendResults results;
+
+  for (auto& id : peer_ids) {
+    auto it = peers_.find(id);
+    if (it == peers_.end()) {
+      results[id] = SEND_FAILED;
+      continue;
+    }
+    results[id] = it->second->TrySend(data);
+  }
+
+  return results;
+}
+
+
+//
+// Statistics of peers
+//
+
+void Control::GetStats(const string peer_id, StatsCallback callback) {
+
+  // Peers are read on this thread only
+  if (webrtc_thread_ != rtc::Thread::Current()) {
+    StatsMessage *data = new StatsMessage(StatsData{ peer_id, std::move(callback), false, PeerStats() }, ref_);
+    webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_GET_STATS, data);
+    return;
+  }
+
+  auto it = peers_.find(peer_id);
+  if (it == peers_.end()) {
+    PeerStats stats;
+    stats.peer_id_ = peer_id;
+    if (callback) callback(false, stats);
+    return;
+  }
+
+  it->second->GetStats(PostedStatsCallback(std::move(callback)));
+}
+
+//
+// WebRTC delivers stats on its signaling thread. Run |callback| on the
+// thread of Peer::Run() instead, so it is called there whatever thread
+// signaling runs on.
+//
+
+StatsCallback Control::PostedStatsCallback(StatsCallback callback) {
+  if ( !callback ) return callback;
+
+  std::weak_ptr<Control> control(ref_);
+  rtc::Thread* thread = webrtc_thread_;
+
+  return [control, thread, callback](bool result, const PeerStats& stats) {
+    auto ref = control.lock();
+    if ( !ref || thread->IsCurrent() ) {
+      callback(result, stats);
+      return;
+    }
+
+    StatsMessage *data = new StatsMessage(StatsData{ stats.peer_id_, callback, result, stats }, ref);
+    thread->Post(RTC_FROM_HERE, ref.get(), MSG_STATS_DELIVERED, data);
+  };
+}
+
+void Control::EmitStats() {
+  if ( stats_interval_ <= 0 ) return;
+
+  // Stats are delivered later, when this might have been released
+  std::weak_ptr<Control> control(ref_);
+
+  for (auto& peer : peers_) {
+    if ( peer.second->state() != PeerControl::pOpen ) continue;
+
+    peer.second->GetStats(PostedStatsCallback([control](bool result, const PeerStats& stats) {
+      auto ref = control.lock();
+      if ( !result || !ref || ref->peer_ == nullptr ) return;
+      ref->peer_->OnStats(stats);
+    }));
+  }
+
+  webrtc_thread_->PostDelayed(RTC_FROM_HERE, stats_interval_, this, MSG_EMIT_STATS);
 }
 
 
@@ -234,8 +467,8 @@ bool Control::SyncSend(const string to, const char* data, const size_t size) {
 // Send command to other peer by signal server
 //
 
-void Control::SendCommand(const string& peer_id, const string& command, const Json::Value& data) {
-  signal_->SendCommand(peer_id, command, data);
+void Control::SendCommand(const SignalCommand& command) {
+  signal_->SendCommand(command);
 }
 
 
@@ -252,7 +485,7 @@ void Control::OnPeerConnect(const string peer_id) {
 void Control::OnPeerClose(const string peer_id, CloseCode code) {
 
   if (webrtc_thread_ != rtc::Thread::Current()) {
-    ControlMessageData *data = new ControlMessageData(peer_id, ref_);
+    PeerCloseMessage *data = new PeerCloseMessage(PeerCloseData{ peer_id, code }, ref_);
 
     // Call Control::OnPeerDisconnected()
     webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_ON_PEER_CLOSE, data);
@@ -276,12 +509,60 @@ void Control::OnPeerClose(const string peer_id, CloseCode code) {
 // Signal receiving data
 //
 
-void Control::OnPeerMessage(const string& peer_id, const char* data, const size_t size) {
+void Control::OnPeerMessage(const PeerHandle& peer, const rtc::CopyOnWriteBuffer& data) {
+  if ( receive_queue_ ) {
+    QueueMessage(peer, data);
+    return;
+  }
+
   if ( peer_ == nullptr ) {
-    LOG_F( WARNING ) << "peer_ is null, peer is " << peer_id;
+    LOG_F( WARNING ) << "peer_ is null, peer is " << peer.id();
     return;
   }
-  peer_->OnMessage(peer_id, data, size);
+  peer_->OnMessage(peer, data.data<char>(), data.size());
+}
+
+//
+// Hand a received message to the thread calling Peer::Poll(), so a slow
+// handler does not hold up the WebRTC thread.
+//
+
+void Control::QueueMessage(const PeerHandle& peer, const rtc::CopyOnWriteBuffer& data) {
+  ReceivedMessage message{ peer, data };
+
+  if ( receive_queue_->Push(std::move(message)) ) {
+    receive_overflowed_ = false;
+    return;
+  }
+
+  //
+  // Wait for Poll() to make room, but not past RECEIVE_BLOCK_TIMEOUT or a
+  // Close(). A consumer that stopped polling, or Poll() called on this very
+  // thread, would otherwise hang closing, ICE and signaling for good. Once
+  // a wait timed out, messages are dropped until the queue has room.
+  //
+
+  if ( receive_overflow_ == RECEIVE_BLOCK && !receive_overflowed_ ) {
+    const int64_t deadline = rtc::TimeMillis() + RECEIVE_BLOCK_TIMEOUT;
+
+    // Push() leaves |message| as it was if the queue is full
+    while ( !close_requested_ && rtc::TimeMillis() < deadline ) {
+      if ( receive_queue_->Push(std::move(message)) ) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Log once for each run of dropped messages
+  if ( !receive_overflowed_ ) {
+    LOG_F( WARNING ) << "Receive queue is full, dropping messages of " << peer.id();
+    receive_overflowed_ = true;
+  }
+
+  if ( receive_overflow_ == RECEIVE_CLOSE ) {
+    ClosePeer(peer.id(), CLOSE_ABNORMAL, FORCE_QUEUING_ON);
+  }
 }
 
 void Control::OnPeerWritable(const string& peer_id) {
@@ -310,90 +591,100 @@ void Control::UnregisterObserver() {
 // Thread message queue
 //
 
+//
+// A message is deleted at the end of its case. It may hold the last
+// reference to this, so nothing touches this after the switch.
+//
+
 void Control::OnMessage(rtc::Message* msg) {
-  ControlMessageData* param = nullptr;
-    switch (msg->message_id) {
-  case MSG_COMMAND_RECEIVED:
-    param = static_cast<ControlMessageData*>(msg->pdata);
-    OnCommandReceived(param->data_json_);
+  switch (msg->message_id) {
+  case MSG_COMMAND_RECEIVED: {
+    std::unique_ptr<CommandMessage> param(static_cast<CommandMessage*>(msg->pdata));
+    OnCommandReceived(param->data_);
     break;
+  }
   case MSG_CLOSE:
-    param = static_cast<ControlMessageData*>(msg->pdata);
-    Close((CloseCode)param->data_int32_);
+  case MSG_ON_SIGLAL_CONNECTION_CLOSE: {
+    std::unique_ptr<CloseMessage> param(static_cast<CloseMessage*>(msg->pdata));
+    Close(param->data_);
+    break;
+  }
+  case MSG_CLOSE_PEER: {
+    std::unique_ptr<PeerCloseMessage> param(static_cast<PeerCloseMessage*>(msg->pdata));
+    ClosePeer(param->data_.peer_id_, param->data_.code_);
+    break;
+  }
+  case MSG_ON_PEER_CLOSE: {
+    std::unique_ptr<PeerCloseMessage> param(static_cast<PeerCloseMessage*>(msg->pdata));
+    OnPeerClose(param->data_.peer_id_, param->data_.code_);
+    break;
+  }
+  case MSG_FILL_PEER_POOL: {
+    std::unique_ptr<RefMessage> param(static_cast<RefMessage*>(msg->pdata));
+    FillPeerPool();
     break;
-  case MSG_CLOSE_PEER:
-    param = static_cast<ControlMessageData*>(msg->pdata);
-    ClosePeer(param->data_string_, (CloseCode) param->data_int32_);
+  }
+  case MSG_EMIT_STATS:
+    EmitStats();
     break;
-  case MSG_ON_PEER_CLOSE:
-    param = static_cast<ControlMessageData*>(msg->pdata);
-    OnPeerClose(param->data_string_, (CloseCode) param->data_int32_);
+  case MSG_GET_STATS: {
+    std::unique_ptr<StatsMessage> param(static_cast<StatsMessage*>(msg->pdata));
+    GetStats(param->data_.peer_id_, std::move(param->data_.callback_));
     break;
-  case MSG_ON_SIGLAL_CONNECTION_CLOSE:
-    param = static_cast<ControlMessageData*>(msg->pdata);
-    Close((CloseCode)param->data_int32_);
+  }
+  case MSG_STATS_DELIVERED: {
+    std::unique_ptr<StatsMessage> param(static_cast<StatsMessage*>(msg->pdata));
+    param->data_.callback_(param->data_.result_, param->data_.stats_);
     break;
+  }
   default:
     LOG_F( WARNING ) << "Unknown message";
     break;
   }
-
-  if (param != nullptr) delete param;
-  return;
 }
 
 //
 // Dispatch command from signal server
 //
 
-void Control::OnCommandReceived(const Json::Value& message) {
-
-  Json::Value data;
-  string command;
-  string peer_id;
+void Control::OnCommandReceived(const SignalCommand& command) {
 
-  if (!rtc::GetStringFromJsonObject(message, "command", &command) ||
-      !rtc::GetValueFromJsonObject(message, "data", &data)) {
-
-    LOG_F(LERROR) << "Invalid message:" << message;
-    return;
-  }
-
-  if (!rtc::GetStringFromJsonObject(message, "peer_id", &peer_id)) {
-    peer_id.clear();
-  }
-
-  if (command == "open") {
-    OnOpen(data);
-  }
-  else if (command == "channelcreate") {
-    OnChannelCreate(data);
-  }
-  else if (command == "channeljoin") {
-    OnChannelJoin(data);
-  }
-  else if (command == "channelleave") {
-    OnChannelLeave(data);
-  }
-  else if (command == "peerclosed") {
-    OnRemotePeerClose(peer_id, data);
-  }
-  else if (command == "createoffer") {
-    CreateOffer(data);
-  }
-  else if (command == "offersdp") {
-    ReceiveOfferSdp(peer_id, data);
-  }
-  else if (command == "answersdp") {
-    ReceiveAnswerSdp(peer_id, data);
-  }
-  else if (command == "ice_candidate") {
-    AddIceCandidate(peer_id, data);
+  switch (command.type_) {
+  case SIGNAL_OPEN:
+    OnOpen(command);
+    break;
+  case SIGNAL_CHANNEL_CREATE:
+    OnChannelCreate(command);
+    break;
+  case SIGNAL_CHANNEL_JOIN:
+    OnChannelJoin(command);
+    break;
+  case SIGNAL_CHANNEL_LEAVE:
+    OnChannelLeave(command);
+    break;
+  case SIGNAL_PEER_CLOSED:
+    OnRemotePeerClose(command.peer_id_, command);
+    break;
+  case SIGNAL_CREATE_OFFER:
+    CreateOffer(command);
+    break;
+  case SIGNAL_OFFER_SDP:
+    ReceiveOfferSdp(command.peer_id_, command);
+    break;
+  case SIGNAL_ANSWER_SDP:
+    ReceiveAnswerSdp(command.peer_id_, command);
+    break;
+  case SIGNAL_ICE_CANDIDATE:
+    AddIceCandidate(command.peer_id_, command);
+    break;
+  default:
+    LOG_F( WARNING ) << "Unknown command, type is " << command.type_;
+    break;
   }
 }
 
-void Control::OnSignalCommandReceived(const Json::Value& message) {
-  ControlMessageData *data = new ControlMessageData(message, ref_);
+void Control::OnSignalCommandReceived(const SignalCommand& command) {
+  CommandMessage *data = new CommandMessage(command, ref_);
   webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_COMMAND_RECEIVED, data);
   LOG_F( INFO ) << "Done";
 }
@@ -401,7 +692,7 @@ void Control::OnSignalCommandReceived(const Json::Value& message) {
 void Control::OnSignalConnectionClosed(websocketpp::close::status::value code) {
   LOG_F(INFO) << "Enter, code is " << code;
   if (code != websocketpp::close::status::normal) {
-    ControlMessageData *data = new ControlMessageData(CLOSE_SIGNAL_ERROR, ref_);
+    CloseMessage *data = new CloseMessage(CLOSE_SIGNAL_ERROR, ref_);
     webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_ON_SIGLAL_CONNECTION_CLOSE, data);
   }
   LOG_F( INFO ) << "Done";
@@ -414,25 +705,25 @@ void Control::OnSignalConnectionClosed(websocketpp::close::status::value code) {
 void Control::CreateChannel(const string name) {
   LOG_F( INFO ) << "channel is " << name;
 
-  Json::Value data;
-  data["name"] = name;
-  SendCommand(name, "createchannel", data);
+  SignalCommand command(SIGNAL_CREATE_CHANNEL, name);
+  command.name_ = name;
+  SendCommand(command);
 }
 
 void Control::JoinChannel(const string name) {
   LOG_F( INFO ) << "channel is " << name;
 
-  Json::Value data;
-  data["name"] = name;
-  SendCommand(name, "joinchannel", data);
+  SignalCommand command(SIGNAL_JOIN_CHANNEL, name);
+  command.name_ = name;
+  SendCommand(command);
 }
 
 void Control::LeaveChannel(const string name) {
   LOG_F( INFO ) << "channel is " << name;
 
-  Json::Value data;
-  data["name"] = name;
-  SendCommand(name, "leavechannel", data);
+  SignalCommand command(SIGNAL_LEAVE_CHANNEL, name);
+  command.name_ = name;
+  SendCommand(command);
 }
 
 
@@ -443,86 +734,107 @@ void Control::LeaveChannel(const string name) {
 bool Control::CreatePeerFactory(
   const webrtc::MediaConstraints* constraints) {
 
-  fake_audio_capture_module_ = FakeAudioCaptureModule::Create();
-  if (fake_audio_capture_module_ == NULL) {
-    LOG_F( LERROR ) << "Failed to create FakeAudioCaptureModule";
+  factory_ = PeerFactory::Create(dedicated_threads_, shared_factory_);
+  if (!factory_) {
+    LOG_F( LERROR ) << "Failed to create PeerFactory";
     return false;
   }
 
-  peer_connection_factory_ = webrtc::CreatePeerConnectionFactory(
-    rtc::Thread::Current(), rtc::Thread::Current(), rtc::Thread::Current(),
-    fake_audio_capture_module_, nullptr, nullptr, nullptr, nullptr, NULL, NULL);
-
-  if (!peer_connection_factory_.get()) {
-    LOG_F( LERROR ) << "Failed to create CreatePeerConnectionFactory";
-    return false;
-  }
+  peer_connection_factory_ = factory_->peer_connection_factory();
 
   LOG_F( INFO ) << "Done";
   return true;
 }
 
-
 //
-// Add ice candidate to local peer from remote peer
+// Create a peer for |remote_id|. A prepared peer is taken from the pool
+// if any, and the pool is refilled later so the caller does not wait.
 //
 
-void Control::AddIceCandidate(const string& peer_id, const Json::Value& data) {
+rtc::scoped_refptr<PeerControl> Control::CreatePeer(const string& remote_id) {
+  Peer peer;
 
-  string sdp_mid;
-  int sdp_mline_index;
-  string candidate;
+  if ( !peer_pool_.empty() ) {
+    peer = peer_pool_.front();
+    peer_pool_.pop_front();
+    peer->set_remote_id(remote_id);
 
-  if ( !rtc::GetStringFromJsonObject( data, "sdp_mid", &sdp_mid ) ) {
-    LOG_F( LERROR ) << "sdp_mid not found, " << data.toStyledString();
-    return;
+    webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_FILL_PEER_POOL, new RefMessage(ref_));
+  }
+  else {
+    peer = new rtc::RefCountedObject<PeerControl>(peer_name_, remote_id, this, peer_connection_factory_);
   }
 
-  if ( !rtc::GetIntFromJsonObject( data, "sdp_mline_index", &sdp_mline_index ) ) {
-    LOG_F( LERROR ) << "sdp_mline_index not found, " << data.toStyledString();
-    return;
+  peer->set_send_watermarks(send_high_watermark_, send_low_watermark_);
+  peer->set_channels(channels_, stripe_chunk_size_);
+  peer->set_candidate_batch_delay(candidate_batch_delay_);
+  peer->set_ice(ice_);
+
+  if ( !peer->Initialize() ) {
+    return nullptr;
   }
 
-  if ( !rtc::GetStringFromJsonObject( data, "candidate", &candidate ) ) {
-    LOG_F( LERROR ) << "candidate not found, " << data.toStyledString();
+  return peer;
+}
+
+void Control::FillPeerPool() {
+  while ( peer_pool_.size() < peer_pool_size_ && peer_connection_factory_ ) {
+    Peer peer = new rtc::RefCountedObject<PeerControl>(peer_name_, string(), this, peer_connection_factory_);
+    peer->set_ice(ice_);
+    if ( !peer->Prepare() ) {
+      LOG_F( LERROR ) << "Peer preparation failed";
+      return;
+    }
+
+    peer_pool_.push_back(peer);
+  }
+}
+
+
+//
+// Add ice candidate to local peer from remote peer. A remote peer batching
+// its candidates sends { "candidates" : [ ... ] } instead of one candidate.
+//
+
+void Control::AddIceCandidate(const string& peer_id, const SignalCommand& command) {
+
+  auto peer = peers_.find( peer_id );
+  if ( peer == peers_.end() ) {
+    LOG_F( WARNING ) << "peer_id not found, peer_id is " << peer_id;
     return;
   }
 
-  if ( peers_.find( peer_id ) == peers_.end() ) {
-    LOG_F( WARNING ) << "peer_id not found, peer_id is " << peer_id << " and " <<
-                        "data is " << data.toStyledString();
+  if ( command.candidates_.empty() ) {
+    LOG_F( LERROR ) << "candidate not found, peer_id is " << peer_id;
     return;
   }
 
-  peers_[peer_id]->AddIceCandidate(sdp_mid, sdp_mline_index, candidate);
+  for ( const auto& candidate : command.candidates_ ) {
+    peer->second->AddIceCandidate( candidate.sdp_mid_, candidate.sdp_mline_index_, candidate.candidate_ );
+  }
+
   LOG_F( INFO ) << "Done, peer_id is " << peer_id;
 }
 
 
 
+
 //
 // 'open' command
 //
 
-void Control::OnOpen(const Json::Value& data) {
-  bool result;
-  if (!rtc::GetBoolFromJsonObject(data, "result", &result)) {
-    LOG_F(WARNING) << "Unknown open response";
-    return;
-  }
-
-  if (!result) {
+void Control::OnOpen(const SignalCommand& command) {
+  if (!command.result_) {
     LOG_F(LERROR) << "Open failed";
     return;
   }
 
-  string session_id;
-  if (!rtc::GetStringFromJsonObject(data, "session_id", &session_id)) {
+  if (command.session_id_.empty()) {
     LOG_F(LERROR) << "Open failed - no session_id";
     return;
   }
 
-  session_id_ = session_id;
+  session_id_ = command.session_id_;
 
   //
   // Create channel
@@ -533,62 +845,69 @@ void Control::OnOpen(const Json::Value& data) {
 }
 
 
-void Control::OnChannelCreate(const Json::Value& data) {
-  bool result;
-  if (!rtc::GetBoolFromJsonObject(data, "result", &result)) {
-    LOG_F(WARNING) << "Unknown open response";
-    peer_->OnClose(peer_name_, CLOSE_SIGNAL_ERROR);
-    return;
-  }
-
-  string peer_id;
-  if (!rtc::GetStringFromJsonObject(data, "name", &peer_id)) {
+void Control::OnChannelCreate(const SignalCommand& command) {
+  const string& peer_id = command.name_;
+  if (peer_id.empty()) {
     peer_->OnClose(peer_name_, CLOSE_SIGNAL_ERROR);
     LOG_F(LERROR) << "Create channel failed - no channel name";
     return;
   }
 
-  if (!result) {
-    LOG_F(LERROR) << "Create channel failed";
-    string desc;
-    if (!rtc::GetStringFromJsonObject(data, "desc", &desc)) {
-      desc = "Unknown reason";
+  if (!command.result_) {
+    //
+    // After a reconnect the server may still hold the channel of the
+    // connection just lost. Peers stay open while creating it again is
+    // retried with the reconnect delays.
+    //
+
+    if ( channel_created_ ) {
+      SignalCommand retry(SIGNAL_CREATE_CHANNEL, peer_name_);
+      retry.name_ = peer_name_;
+      if ( signal_->SendCommandLater(retry) ) {
+        LOG_F( WARNING ) << "Create channel failed again, retrying: " << command.desc_;
+        return;
+      }
     }
 
-    peer_->OnClose(peer_id, CLOSE_SIGNAL_ERROR, desc);
+    LOG_F(LERROR) << "Create channel failed";
+    peer_->OnClose(peer_id, CLOSE_SIGNAL_ERROR, command.desc_.empty() ? "Unknown reason" : command.desc_);
     return;
   }
 
-  peer_->OnOpen(peer_id);
-  LOG_F( INFO ) << "Done";
-}
+  if ( channel_created_ ) {
+    LOG_F( INFO ) << "Channel has been created again, peer_id is " << peer_id;
+    return;
+  }
 
-void Control::OnChannelJoin(const Json::Value& data) {
-  bool result;
+  channel_created_ = true;
 
-  LOG_F(INFO) << "OnChannelJoined(" << data.toStyledString() << ")";
+  // Prepare the pool after the 'open' event is emitted
+  if ( peer_pool_size_ > 0 ) {
+    webrtc_thread_->Post(RTC_FROM_HERE, this, MSG_FILL_PEER_POOL, new RefMessage(ref_));
+  }
 
-  if (!rtc::GetBoolFromJsonObject(data, "result", &result)) {
-    peer_->OnClose( "", CLOSE_SIGNAL_ERROR );
-    LOG_F(LERROR) << "Unknown channel join response";
-    return;
+  // Without a reference to this, so the timer does not keep it alive
+  if ( stats_interval_ > 0 ) {
+    webrtc_thread_->PostDelayed(RTC_FROM_HERE, stats_interval_, this, MSG_EMIT_STATS);
   }
 
-  string peer_id;
-  if (!rtc::GetStringFromJsonObject(data, "name", &peer_id)) {
+  peer_->OnOpen(peer_id);
+  LOG_F( INFO ) << "Done";
+}
+
+void Control::OnChannelJoin(const SignalCommand& command) {
+  LOG_F(INFO) << "OnChannelJoined(" << command.name_ << ")";
+
+  const string& peer_id = command.name_;
+  if (peer_id.empty()) {
     peer_->OnClose( "", CLOSE_SIGNAL_ERROR );
     LOG_F(LERROR) << "Join channel failed - no channel name";
     return;
   }
 
-  if (!result) {
+  if (!command.result_) {
     LOG_F(LERROR) << "Join channel failed";
-    string desc;
-    if (!rtc::GetStringFromJsonObject(data, "desc", &desc)) {
-      desc = "Unknown reason";
-    }
-
-    peer_->OnClose( peer_id, CLOSE_SIGNAL_ERROR, desc );
+    peer_->OnClose( peer_id, CLOSE_SIGNAL_ERROR, command.desc_.empty() ? "Unknown reason" : command.desc_ );
     return;
   }
 
@@ -600,12 +919,12 @@ void Control::OnChannelJoin(const Json::Value& data) {
 // 'leave' command
 //
 
-void Control::OnChannelLeave(const Json::Value& data) {
+void Control::OnChannelLeave(const SignalCommand& command) {
   // Do nothing
 }
 
 
-void Control::OnRemotePeerClose(const string& peer_id, const Json::Value& data) {
+void Control::OnRemotePeerClose(const string& peer_id, const SignalCommand& command) {
   ClosePeer( peer_id, CLOSE_NORMAL );
 }
 
@@ -613,23 +932,21 @@ void Control::OnRemotePeerClose(const string& peer_id, const Json::Value& data)
 // 'createoffer' command
 //
 
-void Control::CreateOffer(const Json::Value& data) {
+void Control::CreateOffer(const SignalCommand& command) {
 
-  Json::Value peers;
-  if (!rtc::GetValueFromJsonObject(data, "peers", &peers)) {
+  if (command.peers_.empty()) {
     LOG_F(LERROR) << "createoffer failed - no peers value";
     return;
   }
 
-  for (size_t i = 0; i < peers.size(); ++i) {
-    string remote_id;
-    if (!rtc::GetStringFromJsonArray(peers, i, &remote_id)) {
+  for (const string& remote_id : command.peers_) {
+    if (remote_id.empty()) {
       LOG_F(LERROR) << "Peer handshake failed - invalid peer id";
       return;
     }
 
-    Peer peer = new rtc::RefCountedObject<PeerControl>(peer_name_, remote_id, this, peer_connection_factory_);
-    if ( !peer->Initialize() ) {
+    Peer peer = CreatePeer(remote_id);
+    if ( !peer ) {
       LOG_F( LERROR ) << "Peer initialization failed";
       OnPeerClose( remote_id, CLOSE_ABNORMAL );
       return;
@@ -646,17 +963,36 @@ void Control::CreateOffer(const Json::Value& data) {
 // 'offersdp' command
 //
 
-void Control::ReceiveOfferSdp(const string& peer_id, const Json::Value& data) {
-  string sdp;
+void Control::ReceiveOfferSdp(const string& peer_id, const SignalCommand& command) {
+  const string& sdp = command.sdp_;
 
-  if ( !rtc::GetStringFromJsonObject( data, "sdp", &sdp ) ) {
-    LOG_F( LERROR ) << "sdp not found, peer_id is " << peer_id << " and " <<
-                        "data is " << data.toStyledString();
+  if ( sdp.empty() ) {
+    LOG_F( LERROR ) << "sdp not found, peer_id is " << peer_id;
     return;
   }
 
-  Peer peer = new rtc::RefCountedObject<PeerControl>(peer_name_, peer_id, this, peer_connection_factory_);
-  if ( !peer->Initialize() ) {
+  //
+  // An offer from an open peer restarts ICE if restarts are enabled. Any
+  // other offer of a known peer, such as a restart while restarts are
+  // disabled here or one crossing our own offer, is dropped and the peer
+  // keeps its connection. A second peer of the same id would not be kept
+  // in peers_, and would be released before it is closed.
+  //
+
+  auto found = peers_.find(peer_id);
+  if ( found != peers_.end() ) {
+    if ( ice_.restart_grace_ > 0 && found->second->state() == PeerControl::pOpen ) {
+      found->second->ReceiveOfferSdp(sdp);
+      LOG_F( INFO ) << "Done, offer of connected peer " << peer_id;
+      return;
+    }
+
+    LOG_F( WARNING ) << "Offer of known peer dropped, peer_id is " << peer_id;
+    return;
+  }
+
+  Peer peer = CreatePeer(peer_id);
+  if ( !peer ) {
     LOG_F( LERROR ) << "Peer initialization failed";
     OnPeerClose( peer_id, CLOSE_ABNORMAL );
     return;
@@ -673,19 +1009,17 @@ void Control::ReceiveOfferSdp(const string& peer_id, const Json::Value& data) {
 // 'answersdp' command
 //
 
-void Control::ReceiveAnswerSdp(const string& peer_id, const Json::Value& data) {
-  string sdp;
+void Control::ReceiveAnswerSdp(const string& peer_id, const SignalCommand& command) {
+  const string& sdp = command.sdp_;
 
-  if ( !rtc::GetStringFromJsonObject( data, "sdp", &sdp ) ) {
-    LOG_F( LERROR ) << "sdp not found, peer_id is " << peer_id << " and " <<
-                        "data is " << data.toStyledString();
+  if ( sdp.empty() ) {
+    LOG_F( LERROR ) << "sdp not found, peer_id is " << peer_id;
     return;
   }
 
   auto peer = peers_.find(peer_id);
   if ( peer == peers_.end() ) {
-    LOG_F( LERROR ) << "peer_id not found, peer_id is " << peer_id << " and " <<
-                        "data is " << data.toStyledString();
+    LOG_F( LERROR ) << "peer_id not found, peer_id is " << peer_id;
     return;
   }
 
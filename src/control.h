@@ -7,18 +7,57 @@
 #ifndef __PEERAPI_CONTROL_H__
 #define __PEERAPI_CONTROL_H__
 
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "peer.h"
+#include "spscqueue.h"
 #include "signalconnection.h"
 #include "controlobserver.h"
 
 #include "rtc_base/third_party/sigslot/sigslot.h"
-#include "fakeaudiocapturemodule.h"
+#include "rtc_base/thread.h"
+#include "peerfactory.h"
 
 
 namespace peerapi {
 
+//
+// A message queued for Peer::Poll(). The buffer is shared with the one
+// received from the data channel, so queueing it copies no payload.
+//
+
+struct ReceivedMessage {
+  PeerHandle peer_;
+  rtc::CopyOnWriteBuffer data_;
+};
+
+using ReceiveQueue = SpscQueue<ReceivedMessage>;
+
+
+//
+// class MessageFreeList
+//
+// Keeps freed memory blocks of one size for reuse. Messages are posted from
+// any thread and freed on the WebRTC thread, so the list has a lock.
+//
+
+class MessageFreeList {
+public:
+  explicit MessageFreeList(std::size_t block_size);
+
+  void* Allocate(std::size_t size);
+  void Free(void* block);
+
+private:
+  const std::size_t block_size_;
+  std::mutex lock_;
+  std::vector<void*> blocks_;
+};
+
 class Control
     : public PeerObserver,
       public sigslot::has_slots<>,
@@ -26,7 +65,6 @@ class Control
 public:
 
   using string = std::string;
-  using DataChannelList = std::vector<std::unique_ptr<PeerDataChannelObserver> >;
 
   explicit Control();
   explicit Control(std::shared_ptr<Signal> signal);
@@ -43,27 +81,45 @@ public:
   // Negotiation and send data
   //
 
-  void Send(const string to, const char* data, const size_t size);
-  bool SyncSend(const string to, const char* data, const size_t size);
+  void Send(const string to, const rtc::CopyOnWriteBuffer& data);
+  bool SyncSend(const string to, const rtc::CopyOnWriteBuffer& data);
+  SendResult TrySend(const string to, const rtc::CopyOnWriteBuffer& data);
+  void SendAsync(const string to, const rtc::CopyOnWriteBuffer& data, SendCallback callback);
+  SendResult TrySend(const string to, const string& channel, const rtc::CopyOnWriteBuffer& data);
+  void SendAsync(const string to, const string& channel, const rtc::CopyOnWriteBuffer& data, SendCallback callback);
+  void SendStriped(const string to, const rtc::CopyOnWriteBuffer& data, SendCallback callback);
+  SendResults Broadcast(const rtc::CopyOnWriteBuffer& data, const PeerFilter& filter);
+  SendResults Multicast(const std::vector<string>& peer_ids, const rtc::CopyOnWriteBuffer& data);
 
   void Open(const string& user_id, const string& user_password, const string& peer_id);
   void Close(const CloseCode code, bool force_queueing = FORCE_QUEUING_OFF);
   void Connect(const string peer_id);
   bool IsWritable(const string peer_id);
-
-  void OnCommandReceived(const Json::Value& message);
-  void OnSignalCommandReceived(const Json::Value& message);
+  void GetStats(const string peer_id, StatsCallback callback);
+
+  void set_send_watermarks(uint64_t high, uint64_t low) { send_high_watermark_ = high; send_low_watermark_ = low; }
+  void set_dedicated_threads(bool dedicated) { dedicated_threads_ = dedicated; }
+  void set_shared_factory(bool shared) { shared_factory_ = shared; }
+  void set_channels(const ChannelSettings& channels, std::size_t stripe_chunk_size) { channels_ = channels; stripe_chunk_size_ = stripe_chunk_size; }
+  void set_candidate_batch_delay(int delay) { candidate_batch_delay_ = delay; }
+  void set_peer_pool_size(std::size_t size) { peer_pool_size_ = size; }
+  void set_ice(const IceSetting& ice) { ice_ = ice; }
+  void set_stats_interval(int interval) { stats_interval_ = interval; }
+  void set_receive_queue(std::shared_ptr<ReceiveQueue> queue, ReceiveOverflow overflow) { receive_queue_ = queue; receive_overflow_ = overflow; }
+
+  void OnCommandReceived(const SignalCommand& command);
+  void OnSignalCommandReceived(const SignalCommand& command);
   void OnSignalConnectionClosed(websocketpp::close::status::value code);
 
   //
   // PeerObserver implementation
   //
 
-  virtual void SendCommand(const string& peer_id, const string& command, const Json::Value& data);
+  virtual void SendCommand(const SignalCommand& command);
   virtual void ClosePeer( const string peer_id, const CloseCode code,  bool force_queueing = FORCE_QUEUING_OFF );
   virtual void OnPeerConnect(const string peer_id);
   virtual void OnPeerClose(const string peer_id, const CloseCode code);
-  virtual void OnPeerMessage(const string& peer_id, const char* data, const size_t size);
+  virtual void OnPeerMessage(const PeerHandle& peer, const rtc::CopyOnWriteBuffer& data);
   virtual void OnPeerWritable(const string& peer_id);
 
 
@@ -79,16 +135,21 @@ protected:
   void JoinChannel(const string name);
   void LeaveChannel(const string name);
   bool CreatePeerFactory(const webrtc::MediaConstraints* constraints);
-  void CreateOffer(const Json::Value& data);
-  void AddIceCandidate(const string& peer_id, const Json::Value& data);
-  void ReceiveOfferSdp(const string& peer_id, const Json::Value& data);
-  void ReceiveAnswerSdp(const string& peer_id, const Json::Value& data);
-
-  void OnOpen(const Json::Value& data);
-  void OnChannelCreate(const Json::Value& data);
-  void OnChannelJoin(const Json::Value& data);
-  void OnChannelLeave(const Json::Value& data);
-  void OnRemotePeerClose(const string& peer_id, const Json::Value& data);
+  rtc::scoped_refptr<PeerControl> CreatePeer(const string& remote_id);
+  void FillPeerPool();
+  void EmitStats();
+  StatsCallback PostedStatsCallback(StatsCallback callback);
+  void QueueMessage(const PeerHandle& peer, const rtc::CopyOnWriteBuffer& data);
+  void CreateOffer(const SignalCommand& command);
+  void AddIceCandidate(const string& peer_id, const SignalCommand& command);
+  void ReceiveOfferSdp(const string& peer_id, const SignalCommand& command);
+  void ReceiveAnswerSdp(const string& peer_id, const SignalCommand& command);
+
+  void OnOpen(const SignalCommand& command);
+  void OnChannelCreate(const SignalCommand& command);
+  void OnChannelJoin(const SignalCommand& command);
+  void OnChannelLeave(const SignalCommand& command);
+  void OnRemotePeerClose(const string& peer_id, const SignalCommand& command);
 
 
   // peer_name_: A name of local peer. Other peers can find this peer by peer_
@@ -99,11 +160,14 @@ protected:
   string session_id_;
 
   std::shared_ptr<Signal> signal_;
-  rtc::scoped_refptr<FakeAudioCaptureModule> fake_audio_capture_module_;
+  std::shared_ptr<PeerFactory> factory_;
 
   using Peer = rtc::scoped_refptr<PeerControl>;
   std::map<string, Peer> peers_;
 
+  // Prepared peers not taken by a remote peer yet
+  std::deque<Peer> peer_pool_;
+
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
       peer_connection_factory_;
 
@@ -114,21 +178,90 @@ private:
     MSG_CLOSE,                      // Queue signout request
     MSG_CLOSE_PEER,                 // Close peer
     MSG_ON_PEER_CLOSE,              // Peer has been closed
-    MSG_ON_SIGLAL_CONNECTION_CLOSE  // Connection to signal server has been closed
+    MSG_ON_SIGLAL_CONNECTION_CLOSE, // Connection to signal server has been closed
+    MSG_FILL_PEER_POOL,             // Prepare peers taken from the pool
+    MSG_EMIT_STATS,                 // Emit 'stats' event of open peers
+    MSG_GET_STATS,                  // Read stats of a peer on this thread
+    MSG_STATS_DELIVERED             // Run a stats callback on this thread
   };
 
+  //
+  // A message holds only the payload of its type, and a reference to this
+  // so it is not released while the message is queued. Freed messages are
+  // reused from a free list of their type. The free list is not a member,
+  // because the queue deletes messages still pending while this is destroyed.
+  //
+
+  template <typename T>
   struct ControlMessageData : public rtc::MessageData {
-    explicit ControlMessageData(Json::Value data, std::shared_ptr<Control> ref) : data_json_(data), ref_(ref) {}
-    explicit ControlMessageData(const string data, std::shared_ptr<Control> ref) : data_string_(data), ref_(ref) {}
-    explicit ControlMessageData(const uint32_t data, std::shared_ptr<Control> ref) : data_int32_(data), ref_(ref) {}
-    Json::Value data_json_;
-    string data_string_;
-    uint32_t data_int32_;
+    explicit ControlMessageData(T data, std::shared_ptr<Control> ref) : data_(std::move(data)), ref_(std::move(ref)) {}
+
+    static void* operator new(std::size_t size) { return FreeList().Allocate(size); }
+    static void operator delete(void* block) { FreeList().Free(block); }
+
+    T data_;
+
+  private:
+    static MessageFreeList& FreeList() {
+      // Never destroyed, so a message may be freed while the process exits
+      static MessageFreeList* free_list = new MessageFreeList(sizeof(ControlMessageData));
+      return *free_list;
+    }
+
+    std::shared_ptr<Control> ref_;
+  };
+
+  // A message without a payload, holding only a reference to this
+  struct RefMessage : public rtc::MessageData {
+    explicit RefMessage(std::shared_ptr<Control> ref) : ref_(std::move(ref)) {}
 
   private:
     std::shared_ptr<Control> ref_;
   };
 
+  struct PeerCloseData {
+    string peer_id_;
+    CloseCode code_;
+  };
+
+  using CommandMessage = ControlMessageData<SignalCommand>;
+  using CloseMessage = ControlMessageData<CloseCode>;
+  using PeerCloseMessage = ControlMessageData<PeerCloseData>;
+
+  struct StatsData {
+    string peer_id_;
+    StatsCallback callback_;
+    bool result_;
+    PeerStats stats_;
+  };
+
+  using StatsMessage = ControlMessageData<StatsData>;
+
+  uint64_t send_high_watermark_;
+  uint64_t send_low_watermark_;
+  bool dedicated_threads_;
+  bool shared_factory_;
+  ChannelSettings channels_;
+  std::size_t stripe_chunk_size_;
+  int candidate_batch_delay_;
+  std::size_t peer_pool_size_;
+  IceSetting ice_;
+  int stats_interval_;
+
+  // Messages are queued here for Peer::Poll() instead of emitted if set.
+  // This is the only producer of the queue.
+  std::shared_ptr<ReceiveQueue> receive_queue_;
+  ReceiveOverflow receive_overflow_;
+  bool receive_overflowed_;
+
+  // Set by Close() on any thread, so a receive blocked on a full queue
+  // gives up instead of holding the WebRTC thread.
+  std::atomic<bool> close_requested_;
+
+  // True once the channel of this peer has been created. A channel created
+  // again after reconnecting to the signal server emits no 'open' event.
+  bool channel_created_;
+
   rtc::Thread* webrtc_thread_;
   ControlObserver* peer_;
   std::shared_ptr<Control> ref_;
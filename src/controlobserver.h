@@ -16,8 +16,9 @@ public:
   virtual void OnOpen(const std::string peer_id) = 0;
   virtual void OnClose(const std::string peer_id, const peerapi::CloseCode code, const std::string desc = "") = 0;
   virtual void OnConnect(const std::string peer_id) = 0;
-  virtual void OnMessage(const std::string peer_id, const char* data, const size_t size) = 0;
+  virtual void OnMessage(const PeerHandle& peer, const char* data, const size_t size) = 0;
   virtual void OnWritable(const std::string peer_id) = 0;
+  virtual void OnStats(const PeerStats& stats) = 0;
 };
 
 } // namespace peerapi
@@ -40,8 +40,9 @@ enum {
   MSG_RUN_PROCESS,
 };
 
-FakeAudioCaptureModule::FakeAudioCaptureModule()
-    : audio_callback_(nullptr),
+FakeAudioCaptureModule::FakeAudioCaptureModule(bool data_only)
+    : data_only_(data_only),
+      audio_callback_(nullptr),
       recording_(false),
       playing_(false),
       play_is_initialized_(false),
@@ -58,9 +59,10 @@ FakeAudioCaptureModule::~FakeAudioCaptureModule() {
   }
 }
 
-rtc::scoped_refptr<FakeAudioCaptureModule> FakeAudioCaptureModule::Create() {
+rtc::scoped_refptr<FakeAudioCaptureModule> FakeAudioCaptureModule::Create(
+    bool data_only) {
   rtc::scoped_refptr<FakeAudioCaptureModule> capture_module(
-      new rtc::RefCountedObject<FakeAudioCaptureModule>());
+      new rtc::RefCountedObject<FakeAudioCaptureModule>(data_only));
   if (!capture_module->Initialize()) {
     return nullptr;
   }
@@ -622,6 +624,11 @@ bool FakeAudioCaptureModule::ShouldStartProcessing() {
 }
 
 void FakeAudioCaptureModule::UpdateProcessing(bool start) {
+  if (data_only_) {
+    // Playout and recording only change state, no frames are processed.
+    return;
+  }
+
   if (start) {
     if (!process_thread_) {
       process_thread_ = rtc::Thread::Create();
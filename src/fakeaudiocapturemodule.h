@@ -49,7 +49,9 @@ class FakeAudioCaptureModule
   static const size_t kNumberBytesPerSample = sizeof(Sample);
 
   // Creates a FakeAudioCaptureModule or returns NULL on failure.
-  static rtc::scoped_refptr<FakeAudioCaptureModule> Create();
+  // A |data_only| module never starts the processing thread, so it costs no
+  // wakeups when PeerConnection only carries data channels.
+  static rtc::scoped_refptr<FakeAudioCaptureModule> Create(bool data_only = false);
 
   // Returns the number of frames that have been successfully pulled by the
   // instance. Note that correctly detecting success can only be done if the
@@ -204,7 +206,7 @@ class FakeAudioCaptureModule
   // exposed in which case the burden of proper instantiation would be put on
   // the creator of a FakeAudioCaptureModule instance. To create an instance of
   // this class use the Create(..) API.
-  explicit FakeAudioCaptureModule();
+  explicit FakeAudioCaptureModule(bool data_only);
   // The destructor is protected because it is reference counted and should not
   // be deleted directly.
   virtual ~FakeAudioCaptureModule();
@@ -238,6 +240,9 @@ class FakeAudioCaptureModule
   // Pushes frames to the registered webrtc::AudioTransport.
   void SendFrameP();
 
+  // True if audio frames are never pushed or pulled.
+  const bool data_only_;
+
   // The time in milliseconds when Process() was last called or 0 if no call
   // has been made.
   int64_t last_process_time_ms_;
@@ -28,8 +28,10 @@
 #define BOOST_TEST_MODULE frame
 #include <boost/test/unit_test.hpp>
 
+#include <ctime>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <websocketpp/frame.hpp>
 #include <websocketpp/utilities.hpp>
@@ -536,3 +538,154 @@ BOOST_AUTO_TEST_CASE( continuous_word_mask2 ) {
     frame::word_mask_circ(buffer,12,pkey);
     BOOST_CHECK( std::equal(buffer,buffer+12,unmasked) );
 }
+
+// Masks |length| bytes starting |offset| bytes into a buffer with |kernel| and
+// checks the result against byte_mask_circ
+static bool check_kernel(frame::simd::mask_kernel kernel, size_t length,
+    size_t offset)
+{
+    frame::masking_key_type key;
+    key.c[0] = 0xEE;
+    key.c[1] = 0x70;
+    key.c[2] = 0xFB;
+    key.c[3] = 0xD5;
+
+    std::vector<uint8_t> input(length + offset + 1);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    std::vector<uint8_t> expected(input);
+    std::vector<uint8_t> output(input);
+    frame::byte_mask_circ(&expected[offset],length,
+        frame::prepare_masking_key(key));
+    kernel(&input[offset],&output[offset],length,key.i);
+
+    return output == expected;
+}
+
+BOOST_AUTO_TEST_CASE( simd_mask_kernels ) {
+    std::vector<frame::simd::mask_kernel> kernels;
+    kernels.push_back(&frame::simd::mask_scalar);
+    kernels.push_back(frame::simd::select_kernel());
+#ifdef _WEBSOCKETPP_SSE2_MASKING_
+    kernels.push_back(&frame::simd::mask_sse2);
+#endif
+
+    // lengths around every block size, at unaligned offsets
+    for (size_t k = 0; k < kernels.size(); ++k) {
+        for (size_t length = 0; length <= 300; ++length) {
+            for (size_t offset = 0; offset < 4; ++offset) {
+                BOOST_CHECK( check_kernel(kernels[k],length,offset) );
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( continuous_simd_mask ) {
+    frame::masking_key_type key;
+    key.c[0] = 0xEE;
+    key.c[1] = 0x70;
+    key.c[2] = 0xFB;
+    key.c[3] = 0xD5;
+
+    std::vector<uint8_t> input(1000);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>(i);
+    }
+
+    std::vector<uint8_t> expected(input.size());
+    size_t pkey = frame::prepare_masking_key(key);
+    frame::byte_mask_circ(&input[0],&expected[0],input.size(),pkey);
+
+    // calls not split on word or block boundaries carry the key over
+    std::vector<uint8_t> output(input.size());
+    size_t split[] = {0, 3, 17, 1, 64, 33, 200, 5};
+    size_t pos = 0;
+    for (size_t i = 0; pos < input.size(); ++i) {
+        size_t length = std::min(split[i % 8],input.size() - pos);
+        size_t next = frame::simd_mask_circ(&input[pos],&output[pos],length,
+            pkey);
+        BOOST_CHECK_EQUAL( next, frame::circshift_prepared_key(pkey,length % 4) );
+        pkey = next;
+        pos += length;
+    }
+    BOOST_CHECK( output == expected );
+
+    // in place
+    pkey = frame::prepare_masking_key(key);
+    pkey = frame::simd_mask_circ(&input[0],333,pkey);
+    frame::simd_mask_circ(&input[333],input.size() - 333,pkey);
+    BOOST_CHECK( input == expected );
+}
+
+BOOST_AUTO_TEST_CASE( continuous_simd_mask2 ) {
+    uint8_t buffer[12] = {0xA6, 0x15, 0x97, 0xB9,
+                          0x81, 0x50, 0xAC, 0xBA,
+                          0x9C, 0x1C, 0x9F, 0xF4};
+
+    uint8_t unmasked[12] = {0x48, 0x65, 0x6C, 0x6C,
+                            0x6F, 0x20, 0x57, 0x6F,
+                            0x72, 0x6C, 0x64, 0x21};
+
+    frame::masking_key_type key;
+    key.c[0] = 0xEE;
+    key.c[1] = 0x70;
+    key.c[2] = 0xFB;
+    key.c[3] = 0xD5;
+
+    size_t pkey;
+    pkey = frame::prepare_masking_key(key);
+    frame::simd_mask_circ(buffer,12,pkey);
+    BOOST_CHECK( std::equal(buffer,buffer+12,unmasked) );
+}
+
+volatile uint8_t mask_sink;
+
+// Masks |size| bytes |rounds| times and returns the throughput in MB/s
+template <typename mask_function>
+static double mask_throughput(mask_function mask, size_t size, size_t rounds) {
+    std::vector<uint8_t> buffer(size, 0x5A);
+    frame::masking_key_type key;
+    key.i = 0x12345678;
+    size_t pkey = frame::prepare_masking_key(key);
+
+    std::clock_t start = std::clock();
+    for (size_t i = 0; i < rounds; ++i) {
+        pkey = mask(&buffer[0],&buffer[0],size,pkey);
+    }
+    double seconds = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+    // keep the masking from being optimized away
+    mask_sink = buffer[size / 2];
+
+    double megabytes = double(size) * rounds / (1024 * 1024);
+    return seconds > 0 ? megabytes / seconds : 0;
+}
+
+static size_t byte_mask_circ_copy(uint8_t * i, uint8_t * o, size_t l, size_t k) {
+    return frame::byte_mask_circ(i,o,l,k);
+}
+
+static size_t word_mask_circ_copy(uint8_t * i, uint8_t * o, size_t l, size_t k) {
+    return frame::word_mask_circ(i,o,l,k);
+}
+
+static size_t simd_mask_circ_copy(uint8_t * i, uint8_t * o, size_t l, size_t k) {
+    return frame::simd_mask_circ(i,o,l,k);
+}
+
+// Not a pass/fail check. Prints the throughput of each masking function for
+// a payload of a data channel SDP and a bulk payload.
+BOOST_AUTO_TEST_CASE( mask_benchmark ) {
+    size_t const sizes[] = {2048, 1024 * 1024};
+
+    for (size_t s = 0; s < 2; ++s) {
+        size_t rounds = (64 * 1024 * 1024) / sizes[s];
+        std::cout << "mask " << sizes[s] << " bytes:"
+                  << " byte " << mask_throughput(byte_mask_circ_copy,sizes[s],rounds)
+                  << " MB/s, word " << mask_throughput(word_mask_circ_copy,sizes[s],rounds)
+                  << " MB/s, simd " << mask_throughput(simd_mask_circ_copy,sizes[s],rounds)
+                  << " MB/s" << std::endl;
+    }
+}
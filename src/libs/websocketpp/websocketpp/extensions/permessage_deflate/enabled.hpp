@@ -214,6 +214,7 @@ public:
       , m_client_max_window_bits_mode(mode::accept)
       , m_initialized(false)
       , m_compress_buffer_size(16384)
+      , m_memory_level(4)
     {
         m_dstate.zalloc = Z_NULL;
         m_dstate.zfree = Z_NULL;
@@ -252,7 +253,7 @@ public:
      * information from the negotiation to determine how to initialize the zlib
      * data structures.
      *
-     * @todo memory level, strategy, etc are hardcoded
+     * @todo strategy, etc are hardcoded
      *
      * @param is_server True to initialize as a server, false for a client.
      * @return A code representing the error that occurred, if any
@@ -274,7 +275,7 @@ public:
             Z_DEFAULT_COMPRESSION,
             Z_DEFLATED,
             -1*deflate_bits,
-            4, // memory level 1-9
+            m_memory_level,
             Z_DEFAULT_STRATEGY
         );
 
@@ -431,6 +432,23 @@ public:
         return lib::error_code();
     }
 
+    /// Set the zlib memory level of the compressor
+    /**
+     * A higher level uses more memory for a faster and better compression.
+     * The level is not negotiated, so it can be set on either side. It takes
+     * effect when the extension is initialized after negotiation.
+     *
+     * @param level The memory level, from 1 to 9. The default is 4.
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code set_memory_level(int level) {
+        if (level < 1 || level > 9) {
+            return make_error_code(error::invalid_attribute_value);
+        }
+        m_memory_level = level;
+        return lib::error_code();
+    }
+
     /// Generate extension offer
     /**
      * Creates an offer string to include in the Sec-WebSocket-Extensions
@@ -740,6 +758,7 @@ private:
     bool m_initialized;
     int m_flush;
     size_t m_compress_buffer_size;
+    int m_memory_level;
     lib::unique_ptr_uchar_array m_compress_buffer;
     z_stream m_dstate;
     z_stream m_istate;
@@ -29,6 +29,7 @@
 #define WEBSOCKETPP_FRAME_HPP
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 
 #include <websocketpp/common/system_error.hpp>
@@ -36,6 +37,33 @@
 
 #include <websocketpp/utilities.hpp>
 
+// SIMD masking kernels. SSE2 is part of every x86-64 processor and is used
+// whenever the compiler targets it. AVX2 is compiled in where the compiler can
+// build it for a single function and is picked at run time if the processor
+// supports it. Define _WEBSOCKETPP_NO_SIMD_MASKING_ to mask a machine word at
+// a time only.
+#ifndef _WEBSOCKETPP_NO_SIMD_MASKING_
+    #if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define _WEBSOCKETPP_SSE2_MASKING_
+        #include <emmintrin.h>
+    #endif
+
+    #if defined(_WEBSOCKETPP_SSE2_MASKING_) && defined(__GNUC__) && \
+        (defined(__clang__) || __GNUC__ > 4 || \
+        (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+        #define _WEBSOCKETPP_AVX2_MASKING_
+        #define _WEBSOCKETPP_AVX2_TARGET_ __attribute__((target("avx2")))
+        #include <immintrin.h>
+    #elif defined(_WEBSOCKETPP_SSE2_MASKING_) && defined(_MSC_VER) && \
+        _MSC_VER >= 1800
+        #define _WEBSOCKETPP_AVX2_MASKING_
+        #define _WEBSOCKETPP_AVX2_TARGET_
+        #include <immintrin.h>
+        #include <intrin.h>
+    #endif
+#endif
+
 namespace websocketpp {
 /// Data structures and utility functions for manipulating WebSocket frames
 /**
@@ -312,6 +340,9 @@ void word_mask_exact(uint8_t * data, size_t length, masking_key_type const &
 size_t word_mask_circ(uint8_t * input, uint8_t * output, size_t length,
     size_t prepared_key);
 size_t word_mask_circ(uint8_t * data, size_t length, size_t prepared_key);
+size_t simd_mask_circ(uint8_t const * input, uint8_t * output, size_t length,
+    size_t prepared_key);
+size_t simd_mask_circ(uint8_t * data, size_t length, size_t prepared_key);
 
 /// Check whether the frame's FIN bit is set.
 /**
@@ -855,6 +886,200 @@ inline size_t byte_mask_circ(uint8_t* data, size_t length, size_t prepared_key){
     return byte_mask_circ(data,data,length,prepared_key);
 }
 
+/// Masking kernels used by simd_mask_circ
+/**
+ * Each kernel masks exactly length bytes of input into output with a 32 bit
+ * key whose first byte in memory masks input[0]. input and output may be the
+ * same buffer and need no alignment.
+ */
+namespace simd {
+
+typedef void (*mask_kernel)(uint8_t const *, uint8_t *, size_t, uint32_t);
+
+/// Masks a 64 bit word at a time, with no alignment requirement
+inline void mask_scalar(uint8_t const * input, uint8_t * output, size_t length,
+    uint32_t key)
+{
+    uint32_converter k;
+    k.i = key;
+
+    uint8_t pattern[8];
+    std::memcpy(pattern, k.c, 4);
+    std::memcpy(pattern + 4, k.c, 4);
+    uint64_t key_word;
+    std::memcpy(&key_word, pattern, 8);
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, input + i, 8);
+        word ^= key_word;
+        std::memcpy(output + i, &word, 8);
+    }
+
+    for (; i < length; ++i) {
+        output[i] = input[i] ^ k.c[i % 4];
+    }
+}
+
+#ifdef _WEBSOCKETPP_SSE2_MASKING_
+/// Masks 64 bytes per iteration with SSE2
+inline void mask_sse2(uint8_t const * input, uint8_t * output, size_t length,
+    uint32_t key)
+{
+    __m128i const k = _mm_set1_epi32(static_cast<int>(key));
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i + 48));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_xor_si128(a, k));
+    }
+
+    // i is a multiple of 4, so the key is in phase for the rest
+    mask_scalar(input + i, output + i, length - i, key);
+}
+#endif
+
+#ifdef _WEBSOCKETPP_AVX2_MASKING_
+/// Masks 128 bytes per iteration with AVX2
+_WEBSOCKETPP_AVX2_TARGET_
+inline void mask_avx2(uint8_t const * input, uint8_t * output, size_t length,
+    uint32_t key)
+{
+    __m256i const k = _mm256_set1_epi32(static_cast<int>(key));
+
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i + 96));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i + 32), _mm256_xor_si256(b, k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i + 64), _mm256_xor_si256(c, k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), _mm256_xor_si256(a, k));
+    }
+
+    mask_sse2(input + i, output + i, length - i, key);
+}
+
+/// Whether the processor and operating system support AVX2
+inline bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // AVX registers must be enabled by the OS (OSXSAVE and XCR0 bits 1, 2)
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) {
+        return false;
+    }
+    if ((_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+/// Picks the fastest kernel the processor supports
+inline mask_kernel select_kernel() {
+#ifdef _WEBSOCKETPP_AVX2_MASKING_
+    if (cpu_has_avx2()) {
+        return &mask_avx2;
+    }
+#endif
+#ifdef _WEBSOCKETPP_SSE2_MASKING_
+    return &mask_sse2;
+#else
+    return &mask_scalar;
+#endif
+}
+
+/// Masks with the kernel picked on first use
+inline void mask(uint8_t const * input, uint8_t * output, size_t length,
+    uint32_t key)
+{
+    // Short payloads such as control frames are not worth an indirect call
+    if (length < 16) {
+        mask_scalar(input, output, length, key);
+        return;
+    }
+
+    static mask_kernel const kernel = select_kernel();
+    kernel(input, output, length, key);
+}
+
+} // namespace simd
+
+/// Circular SIMD mask/unmask
+/**
+ * Performs the same masking as byte_mask_circ, using and returning prepared
+ * keys the same way, so streaming state carries over between the two. Masks
+ * with AVX2 or SSE2 where the processor supports them, picked once at run
+ * time, and a 64 bit word at a time otherwise.
+ *
+ * Unlike word_mask_circ the buffers need no alignment or padding. Exactly
+ * length bytes are read and written.
+ *
+ * @param input Character buffer to read from
+ *
+ * @param output Character buffer to write to. May be the same as input.
+ *
+ * @param length Length of data
+ *
+ * @param prepared_key Prepared key to use.
+ *
+ * @return the prepared_key shifted to account for the input length
+ */
+inline size_t simd_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    simd::mask(input, output, length, static_cast<uint32_t>(prepared_key));
+
+    return circshift_prepared_key(prepared_key,length % 4);
+}
+
+/// Circular SIMD mask/unmask (in place)
+/**
+ * In place version of simd_mask_circ
+ *
+ * @see simd_mask_circ
+ *
+ * @param data Character buffer to read from and write to
+ *
+ * @param length Length of data
+ *
+ * @param prepared_key Prepared key to use.
+ *
+ * @return the prepared_key shifted to account for the input length
+ */
+inline size_t simd_mask_circ(uint8_t* data, size_t length, size_t prepared_key){
+    return simd_mask_circ(data,data,length,prepared_key);
+}
+
 } // namespace frame
 } // namespace websocketpp
 
@@ -778,9 +778,8 @@ protected:
     {
         // unmask if masked
         if (frame::get_masked(m_basic_header)) {
-            m_current_msg->prepared_key = frame::byte_mask_circ(
+            m_current_msg->prepared_key = frame::simd_mask_circ(
                 buf, len, m_current_msg->prepared_key);
-            // TODO: SIMD masking
         }
 
         std::string & out = m_current_msg->msg_ptr->get_raw_payload();
@@ -930,7 +929,8 @@ protected:
 
     /// Copy and mask/unmask in one operation
     /**
-     * Reads input from one string and writes unmasked output to another.
+     * Reads input from one string and writes unmasked output to another. o
+     * must be at least as long as i and may be the same string.
      *
      * @param [in] i The input string.
      * @param [out] o The output string.
@@ -939,8 +939,13 @@ protected:
     void masked_copy (std::string const & i, std::string & o,
         frame::masking_key_type key) const
     {
-        frame::byte_mask(i.begin(),i.end(),o.begin(),key);
-        // TODO: SIMD masking
+        if (i.empty()) {
+            return;
+        }
+
+        frame::simd_mask_circ(reinterpret_cast<uint8_t const *>(i.data()),
+            reinterpret_cast<uint8_t *>(&o[0]), i.size(),
+            frame::prepare_masking_key(key));
     }
 
     /// Generic prepare control frame with opcode and payload.
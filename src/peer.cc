@@ -5,11 +5,21 @@
 */
 
 
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <vector>
+
 #include "peer.h"
 #include "logging.h"
 #include "control.h"
 
 #include "pc/test/mock_peer_connection_observers.h"
+#include "api/stats/rtc_stats_collector_callback.h"
+#include "api/stats/rtcstats_objects.h"
+#include "rtc_base/byte_order.h"
+#include "rtc_base/thread.h"
+#include "rtc_base/time_utils.h"
 // #include "api/test/fakeconstraints.h"
 
 
@@ -17,6 +27,101 @@
 
 namespace peerapi {
 
+namespace {
+
+// Data channels are labelled "peer_data_<remote id>" and additional ones
+// "peer_data_<remote id>/<name>". Stripe channels are told apart by their
+// sub-protocol, so the receiver needs no configuration of its own.
+const char kDataChannelPrefix[] = "peer_data_";
+const char kStripeProtocol[] = "peerapi-stripe";
+
+// A stripe chunk starts with message id, chunk index and chunk count,
+// each a big-endian uint32_t.
+const std::size_t kStripeHeaderSize = 12;
+
+// Striped messages received at most this many ids ahead of the next one to
+// deliver. Chunks of others are dropped, so a remote peer can not make
+// assemblies of any id it likes.
+const uint32_t kStripeReceiveWindow = 64;
+
+// A striped message that receives no chunk for this many milliseconds while
+// later ones wait is skipped, in case a chunk of it was lost or never sent.
+const int kStripeTimeout = 10 * 1000;
+
+//
+// Builds PeerStats from a RTCStatsReport and hands it to a callback.
+//
+
+class StatsCollector : public webrtc::RTCStatsCollectorCallback {
+public:
+  StatsCollector(const PeerStats& stats, StatsCallback callback)
+      : stats_(stats), callback_(std::move(callback)) {}
+
+  void OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override {
+    for (const webrtc::RTCStats& stats : *report) {
+      if (stats.type() == webrtc::RTCDataChannelStats::kType) {
+        const auto& channel = stats.cast_to<webrtc::RTCDataChannelStats>();
+        stats_.messages_sent_ += ValueOf(channel.messages_sent);
+        stats_.messages_received_ += ValueOf(channel.messages_received);
+        stats_.bytes_sent_ += ValueOf(channel.bytes_sent);
+        stats_.bytes_received_ += ValueOf(channel.bytes_received);
+      }
+      else if (stats.type() == webrtc::RTCTransportStats::kType) {
+        const auto& transport = stats.cast_to<webrtc::RTCTransportStats>();
+        if (transport.selected_candidate_pair_id.is_defined()) {
+          ReadCandidatePair(*report, *transport.selected_candidate_pair_id);
+        }
+      }
+    }
+
+    callback_(true, stats_);
+  }
+
+private:
+  template <typename T>
+  static T ValueOf(const webrtc::RTCStatsMember<T>& member) {
+    return member.is_defined() ? *member : T();
+  }
+
+  void ReadCandidatePair(const webrtc::RTCStatsReport& report, const std::string& id) {
+    const webrtc::RTCStats* stats = report.Get(id);
+    if (!stats || stats->type() != webrtc::RTCIceCandidatePairStats::kType) return;
+
+    const auto& pair = stats->cast_to<webrtc::RTCIceCandidatePairStats>();
+    stats_.round_trip_time_ = ValueOf(pair.current_round_trip_time) * 1000;
+
+    if (pair.local_candidate_id.is_defined()) {
+      ReadCandidate(report, *pair.local_candidate_id,
+                    &stats_.local_candidate_type_, &stats_.local_address_);
+    }
+    if (pair.remote_candidate_id.is_defined()) {
+      ReadCandidate(report, *pair.remote_candidate_id,
+                    &stats_.remote_candidate_type_, &stats_.remote_address_);
+    }
+  }
+
+  void ReadCandidate(const webrtc::RTCStatsReport& report, const std::string& id,
+                     std::string* type, std::string* address) {
+    const webrtc::RTCStats* stats = report.Get(id);
+    if (!stats) return;
+
+    // Local and remote candidates share the members of RTCIceCandidateStats
+    if (stats->type() != webrtc::RTCLocalIceCandidateStats::kType &&
+        stats->type() != webrtc::RTCRemoteIceCandidateStats::kType) {
+      return;
+    }
+
+    const auto& candidate = static_cast<const webrtc::RTCIceCandidateStats&>(*stats);
+    *type = ValueOf(candidate.candidate_type);
+    *address = ValueOf(candidate.ip) + ":" + std::to_string(ValueOf(candidate.port));
+  }
+
+  PeerStats stats_;
+  StatsCallback callback_;
+};
+
+} // namespace
+
 //
 // class PeerControl
 //
@@ -26,11 +131,26 @@ PeerControl::PeerControl(const string local_id,
                          PeerObserver* observer,
                          rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
                              peer_connection_factory)
-    : local_id_(local_id),
+    : peer_connection_factory_(peer_connection_factory),
+      local_id_(local_id),
       remote_id_(remote_id),
-      control_(observer),
-      peer_connection_factory_(peer_connection_factory),
-      state_(pClosed) {
+      remote_handle_(remote_id),
+      stripe_chunk_size_(DEFAULT_STRIPE_CHUNK_SIZE),
+      next_stripe_channel_(0),
+      next_stripe_send_id_(0),
+      next_stripe_receive_id_(0),
+      stripe_progress_(0),
+      stripe_timeout_progress_(0),
+      stripe_timeout_pending_(false),
+      candidate_batch_delay_(DEFAULT_CANDIDATE_BATCH_DELAY),
+      offerer_(false),
+      ice_disconnected_(false),
+      initialize_time_(0),
+      connect_time_(0),
+      state_(pClosed),
+      send_high_watermark_(DEFAULT_SEND_HIGH_WATERMARK),
+      send_low_watermark_(DEFAULT_SEND_LOW_WATERMARK),
+      control_(observer) {
 
 }
 
@@ -41,7 +161,14 @@ PeerControl::~PeerControl() {
 }
 
 
-bool PeerControl::Initialize() {
+//
+// Create a peer connection before the remote peer is known. It starts
+// gathering candidates of one ICE session at once, and Initialize() adds
+// data channels once the peer is taken for a remote peer.
+//
+
+bool PeerControl::Prepare() {
+  ice_.candidate_pool_size_ = std::max(ice_.candidate_pool_size_, 1);
 
   if (!CreatePeerConnection()) {
     LOG_F(LS_ERROR) << "CreatePeerConnection failed";
@@ -49,19 +176,52 @@ bool PeerControl::Initialize() {
     return false;
   }
 
+  LOG_F( INFO ) << "Done";
+  return true;
+}
+
+bool PeerControl::Initialize() {
+
+  initialize_time_ = rtc::TimeMillis();
+
+  if (!peer_connection_ && !CreatePeerConnection()) {
+    LOG_F(LS_ERROR) << "CreatePeerConnection failed";
+    DeletePeerConnection();
+    return false;
+  }
+
   webrtc::DataChannelInit init;
-  const string data_channel_name = string("peer_data_") + remote_id_;
-  if (!CreateDataChannel(data_channel_name, init)) {
+  if (!CreateDataChannel(string(), init)) {
     LOG_F(LS_ERROR) << "CreateDataChannel failed";
     DeletePeerConnection();
     return false;
   }
 
+  for (auto& channel : channels_) {
+    webrtc::DataChannelInit channel_init;
+    channel_init.ordered = channel.ordered_;
+    if (channel.max_retransmits_ >= 0) {
+      channel_init.maxRetransmits = channel.max_retransmits_;
+    }
+    if (channel.max_retransmit_time_ >= 0) {
+      channel_init.maxRetransmitTime = channel.max_retransmit_time_;
+    }
+    if (channel.stripe_) {
+      channel_init.protocol = kStripeProtocol;
+    }
+
+    if (!CreateDataChannel(channel.name_, channel_init)) {
+      LOG_F(LS_ERROR) << "CreateDataChannel failed, channel is " << channel.name_;
+      DeletePeerConnection();
+      return false;
+    }
+  }
+
   LOG_F( INFO ) << "Done";
   return true;
 }
 
-bool PeerControl::Send(const char* buffer, const size_t size) {
+bool PeerControl::Send(const rtc::CopyOnWriteBuffer& buffer) {
   RTC_DCHECK( state_ == pOpen );
   
   if ( state_ != pOpen ) {
@@ -69,10 +229,109 @@ bool PeerControl::Send(const char* buffer, const size_t size) {
     return false;
   }
 
-  return local_data_channel_->Send(buffer, size);
+  return local_data_channels_.front()->Send(buffer);
 }
 
-bool PeerControl::SyncSend(const char* buffer, const size_t size) {
+SendResult PeerControl::TrySend(const rtc::CopyOnWriteBuffer& buffer) {
+  if ( state_ != pOpen ) {
+    return SEND_FAILED;
+  }
+
+  return local_data_channels_.front()->TrySend(buffer);
+}
+
+bool PeerControl::SendAsync(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback) {
+  if ( state_ != pOpen ) {
+    LOG_F( WARNING ) << "Send data when a peer state is not opened";
+    if ( callback ) callback( false );
+    return false;
+  }
+
+  return local_data_channels_.front()->SendAsync(buffer, std::move(callback));
+}
+
+SendResult PeerControl::TrySend(const string& channel, const rtc::CopyOnWriteBuffer& buffer) {
+  if ( state_ != pOpen ) {
+    return SEND_FAILED;
+  }
+
+  PeerDataChannelObserver* data_channel = LocalDataChannel(channel);
+  if ( data_channel == nullptr ) {
+    LOG_F( WARNING ) << "Unknown channel " << channel;
+    return SEND_FAILED;
+  }
+
+  return data_channel->TrySend(buffer);
+}
+
+bool PeerControl::SendAsync(const string& channel, const rtc::CopyOnWriteBuffer& buffer, SendCallback callback) {
+  PeerDataChannelObserver* data_channel = state_ == pOpen ? LocalDataChannel(channel) : nullptr;
+
+  if ( data_channel == nullptr ) {
+    LOG_F( WARNING ) << "Send data to a closed peer or an unknown channel " << channel;
+    if ( callback ) callback( false );
+    return false;
+  }
+
+  return data_channel->SendAsync(buffer, std::move(callback));
+}
+
+//
+// Split |buffer| into chunks and send them round-robin over the stripe
+// channels, so one large message uses several SCTP streams at once.
+// |callback| runs once all chunks have left the send buffers.
+//
+
+bool PeerControl::SendStriped(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback) {
+  if ( state_ != pOpen || stripe_channels_.empty() ) {
+    LOG_F( WARNING ) << "Send striped data when a peer is not opened or has no stripe channel";
+    if ( callback ) callback( false );
+    return false;
+  }
+
+  if ( buffer.size() > MAX_STRIPE_MESSAGE_SIZE ) {
+    LOG_F( WARNING ) << "Striped data is larger than " << MAX_STRIPE_MESSAGE_SIZE << " bytes";
+    if ( callback ) callback( false );
+    return false;
+  }
+
+  const std::size_t count = std::max<std::size_t>(1, (buffer.size() + stripe_chunk_size_ - 1) / stripe_chunk_size_);
+  const uint32_t message_id = next_stripe_send_id_++;
+
+  SendCallback chunk_sent;
+  if ( callback ) {
+    auto remaining = std::make_shared<std::atomic<std::size_t>>(count);
+    auto succeeded = std::make_shared<std::atomic<bool>>(true);
+    chunk_sent = [remaining, succeeded, callback](bool success) {
+      if ( !success ) succeeded->store(false);
+      if ( remaining->fetch_sub(1) == 1 ) callback(succeeded->load());
+    };
+  }
+
+  bool result = true;
+  for (std::size_t index = 0; index < count; ++index) {
+    const std::size_t offset = index * stripe_chunk_size_;
+    const std::size_t size = std::min(stripe_chunk_size_, buffer.size() - offset);
+
+    rtc::CopyOnWriteBuffer chunk(kStripeHeaderSize + size);
+    uint8_t* data = chunk.data();
+    rtc::SetBE32(data, message_id);
+    rtc::SetBE32(data + 4, static_cast<uint32_t>(index));
+    rtc::SetBE32(data + 8, static_cast<uint32_t>(count));
+    if ( size > 0 ) {
+      std::memcpy(data + kStripeHeaderSize, buffer.cdata() + offset, size);
+    }
+
+    PeerDataChannelObserver* channel = stripe_channels_[next_stripe_channel_++ % stripe_channels_.size()];
+    if ( !channel->SendAsync(chunk, chunk_sent) ) {
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+bool PeerControl::SyncSend(const rtc::CopyOnWriteBuffer& buffer) {
   RTC_DCHECK( state_ == pOpen );
 
   if ( state_ != pOpen ) {
@@ -80,7 +339,7 @@ bool PeerControl::SyncSend(const char* buffer, const size_t size) {
     return false;
   }
 
-  return local_data_channel_->SyncSend(buffer, size);
+  return local_data_channels_.front()->SyncSend(buffer);
 }
 
 bool PeerControl::IsWritable() {
@@ -90,7 +349,31 @@ bool PeerControl::IsWritable() {
     return false;
   }
 
-  return local_data_channel_->IsWritable();
+  return local_data_channels_.front()->IsWritable();
+}
+
+//
+// Read statistics of the peer. |callback| runs on the signaling thread once
+// WebRTC has collected them, or at once with false if the peer is not open.
+//
+
+void PeerControl::GetStats(StatsCallback callback) {
+  PeerStats stats;
+  stats.peer_id_ = remote_id_;
+  stats.connect_time_ = connect_time_;
+
+  if ( state_ != pOpen || !peer_connection_ ) {
+    if ( callback ) callback( false, stats );
+    return;
+  }
+
+  for (auto& channel : local_data_channels_) {
+    stats.buffered_amount_ += channel->BufferedAmount();
+  }
+
+  rtc::scoped_refptr<StatsCollector> collector(
+    new rtc::RefCountedObject<StatsCollector>(stats, std::move(callback)));
+  peer_connection_->GetStats(collector.get());
 }
 
 void PeerControl::Close(const CloseCode code) {
@@ -127,6 +410,7 @@ void PeerControl::CreateOffer(const webrtc::MediaConstraints* constraints) {
   RTC_DCHECK( state_ == pClosed );
 
   state_ = pConnecting;
+  offerer_ = true;
   webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
   // if (mandatory_receive_) {
   //   options.offer_to_receive_audio = true;
@@ -138,16 +422,21 @@ void PeerControl::CreateOffer(const webrtc::MediaConstraints* constraints) {
 
 
 void PeerControl::CreateAnswer(const webrtc::MediaConstraints* constraints) {
-  RTC_DCHECK( state_ == pClosed );
+  RTC_DCHECK( state_ == pClosed || state_ == pOpen );
   webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
-  state_ = pConnecting;
+
+  // An open peer answers an ICE restart and stays open
+  if ( state_ == pClosed ) {
+    state_ = pConnecting;
+  }
+
   peer_connection_->CreateAnswer(this, options);
   LOG_F( INFO ) << "Done";
 }
 
 
 void PeerControl::ReceiveOfferSdp(const string& sdp) {
-  RTC_DCHECK( state_ == pClosed);
+  RTC_DCHECK( state_ == pClosed || state_ == pOpen );
   SetRemoteDescription(webrtc::SessionDescriptionInterface::kOffer, sdp);
   CreateAnswer(NULL);
   LOG_F( INFO ) << "Done";
@@ -155,7 +444,7 @@ void PeerControl::ReceiveOfferSdp(const string& sdp) {
 
 
 void PeerControl::ReceiveAnswerSdp(const string& sdp) {
-  RTC_DCHECK( state_ == pConnecting );
+  RTC_DCHECK( state_ == pConnecting || state_ == pOpen );
   SetRemoteDescription(webrtc::SessionDescriptionInterface::kAnswer, sdp);
   LOG_F( INFO ) << "Done";
 }
@@ -163,9 +452,24 @@ void PeerControl::ReceiveAnswerSdp(const string& sdp) {
 void PeerControl::OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel) {
   LOG_F( INFO ) << "remote_id_ is " << remote_id_;
 
-  PeerDataChannelObserver* Observer = new PeerDataChannelObserver(channel);
-  remote_data_channel_ = std::unique_ptr<PeerDataChannelObserver>(Observer);
-  Attach(remote_data_channel_.get());
+  //
+  // The remote peer labels channels with our id, and a name follows
+  // after '/' unless it is the default channel.
+  //
+
+  const string prefix = kDataChannelPrefix + local_id_;
+  const string label = channel->label();
+  string name;
+
+  if (label.compare(0, prefix.size(), prefix) != 0) {
+    LOG_F( WARNING ) << "Unexpected data channel label " << label;
+  }
+  else if (label.size() > prefix.size()) {
+    name = label.substr(prefix.size() + 1);
+  }
+
+  remote_data_channels_.emplace_back(new PeerDataChannelObserver(channel, name));
+  Attach(remote_data_channels_.back().get());
 
   LOG_F( INFO ) << "Done";
 }
@@ -196,7 +500,12 @@ void PeerControl::OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConn
     // Peer disconnected and notify it to control that makes control trigger closing
     //
     LOG_F( INFO ) << "new_state is " << "kIceConnectionDisconnected";
-    OnPeerDisconnected();
+    if ( ice_.restart_grace_ > 0 && state_ == pOpen ) {
+      WaitForIceRestart();
+    }
+    else {
+      OnPeerDisconnected();
+    }
     break;
   case webrtc::PeerConnectionInterface::IceConnectionState::kIceConnectionNew:
     LOG_F( INFO ) << "new_state is " << "kIceConnectionNew";
@@ -206,12 +515,17 @@ void PeerControl::OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConn
     break;
   case webrtc::PeerConnectionInterface::IceConnectionState::kIceConnectionConnected:
     LOG_F( INFO ) << "new_state is " << "kIceConnectionConnected";
+    CancelIceRestart();
     break;
   case webrtc::PeerConnectionInterface::IceConnectionState::kIceConnectionCompleted:
     LOG_F( INFO ) << "new_state is " << "kIceConnectionCompleted";
+    CancelIceRestart();
     break;
   case webrtc::PeerConnectionInterface::IceConnectionState::kIceConnectionFailed:
     LOG_F( INFO ) << "new_state is " << "kIceConnectionFailed";
+    if ( ice_.restart_grace_ > 0 && state_ == pOpen ) {
+      WaitForIceRestart();
+    }
     break;
   default:
     break;
@@ -223,14 +537,107 @@ void PeerControl::OnIceCandidate(const webrtc::IceCandidateInterface* candidate)
   string sdp;
   if (!candidate->ToString(&sdp)) return;
 
-  Json::Value data;
+  IceCandidateData data;
 
-  data["sdp_mid"] = candidate->sdp_mid();
-  data["sdp_mline_index"] = candidate->sdp_mline_index();
-  data["candidate"] = sdp;
+  data.sdp_mid_ = candidate->sdp_mid();
+  data.sdp_mline_index_ = candidate->sdp_mline_index();
+  data.candidate_ = sdp;
 
-  control_->SendCommand(remote_id_, "ice_candidate", data);
-  LOG_F( INFO ) << "Done";
+  if (candidate_batch_delay_ <= 0) {
+    SignalCommand command(SIGNAL_ICE_CANDIDATE, remote_id_);
+    command.candidates_.push_back(std::move(data));
+    control_->SendCommand(command);
+    LOG_F( INFO ) << "Done";
+    return;
+  }
+
+  // The first candidate of a batch starts the timer
+  pending_candidates_.push_back(std::move(data));
+  if (pending_candidates_.size() == 1) {
+    rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, candidate_batch_delay_,
+                                        this, MSG_FLUSH_CANDIDATES);
+  }
+}
+
+void PeerControl::OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state) {
+  if (new_state == webrtc::PeerConnectionInterface::kIceGatheringComplete) {
+    FlushIceCandidates();
+  }
+}
+
+//
+// Send pending candidates in one 'ice_candidate' command as
+// { "candidates" : [ { "sdp_mid", "sdp_mline_index", "candidate" }, ... ] }
+//
+
+void PeerControl::FlushIceCandidates() {
+  if (pending_candidates_.empty()) return;
+
+  LOG_F( INFO ) << "Flush " << pending_candidates_.size() << " candidates";
+
+  SignalCommand command(SIGNAL_ICE_CANDIDATE, remote_id_);
+  command.candidates_.swap(pending_candidates_);
+
+  control_->SendCommand(command);
+}
+
+//
+// Keep a peer with a lost ICE connection open for a while. Data channels
+// and the data queued on them survive an ICE restart, so a network change
+// does not close the peer.
+//
+
+void PeerControl::WaitForIceRestart() {
+  if (ice_disconnected_) return;
+
+  ice_disconnected_ = true;
+  LOG_F( INFO ) << "Waiting for ICE restart, remote_id_ is " << remote_id_;
+
+  rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, ice_.restart_grace_,
+                                      this, MSG_ICE_RESTART);
+  rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, ice_.restart_grace_ * 2,
+                                      this, MSG_ICE_TIMEOUT);
+}
+
+void PeerControl::CancelIceRestart() {
+  if (!ice_disconnected_) return;
+
+  ice_disconnected_ = false;
+  rtc::Thread::Current()->Clear(this, MSG_ICE_RESTART);
+  rtc::Thread::Current()->Clear(this, MSG_ICE_TIMEOUT);
+  LOG_F( INFO ) << "Connected again, remote_id_ is " << remote_id_;
+}
+
+void PeerControl::RestartIce() {
+  // The peer answering the first offer waits for the offer of the other
+  if (!ice_disconnected_ || !offerer_ || state_ != pOpen) return;
+
+  webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+  options.ice_restart = true;
+  peer_connection_->CreateOffer(this, options);
+  LOG_F( INFO ) << "Done, remote_id_ is " << remote_id_;
+}
+
+void PeerControl::OnMessage(rtc::Message* msg) {
+  switch (msg->message_id) {
+  case MSG_FLUSH_CANDIDATES:
+    FlushIceCandidates();
+    break;
+  case MSG_ICE_RESTART:
+    RestartIce();
+    break;
+  case MSG_ICE_TIMEOUT:
+    if (ice_disconnected_) {
+      LOG_F( WARNING ) << "ICE restart timed out, remote_id_ is " << remote_id_;
+      OnPeerDisconnected();
+    }
+    break;
+  case MSG_STRIPE_TIMEOUT:
+    SkipStalledStripe();
+    break;
+  default:
+    break;
+  }
 }
 
 void PeerControl::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
@@ -241,7 +648,8 @@ void PeerControl::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
 
   if (!desc->ToString(&sdp)) return;
 
-  if ( state_ != pConnecting ) {
+  // An open peer makes or answers an offer to restart ICE
+  if ( state_ != pConnecting && state_ != pOpen ) {
     LOG_F( WARNING ) << "Invalid state";
     return;
   }
@@ -251,31 +659,46 @@ void PeerControl::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
 
   //
   // Send message to other peer
-  Json::Value data;
+  SignalCommand command(SIGNAL_UNKNOWN, remote_id_);
 
   if (desc->type() == webrtc::SessionDescriptionInterface::kOffer) {
-    data["sdp"] = sdp;
-    control_->SendCommand(remote_id_, "offersdp", data);
+    command.type_ = SIGNAL_OFFER_SDP;
   }
   else if (desc->type() == webrtc::SessionDescriptionInterface::kAnswer) {
-    data["sdp"] = sdp;
-    control_->SendCommand(remote_id_, "answersdp", data);
+    command.type_ = SIGNAL_ANSWER_SDP;
+  }
+
+  if (command.type_ != SIGNAL_UNKNOWN) {
+    command.sdp_ = std::move(sdp);
+    control_->SendCommand(command);
   }
   LOG_F( INFO ) << "Done";
 }
 
 void PeerControl::OnPeerOpened() {
 
-  // Both local_data_channel_ and remote_data_channel_ has been opened
-  if (local_data_channel_.get() != nullptr && remote_data_channel_.get() != nullptr &&
-      local_data_channel_->state() == webrtc::DataChannelInterface::DataState::kOpen &&
-      remote_data_channel_->state() == webrtc::DataChannelInterface::DataState::kOpen
+  // Additional remote channels may open after the peer is connected
+  if ( state_ != pConnecting ) {
+    return;
+  }
+
+  auto is_open = [](const std::unique_ptr<PeerDataChannelObserver>& channel) {
+    return channel->IsOpen();
+  };
+  auto is_default_open = [](const std::unique_ptr<PeerDataChannelObserver>& channel) {
+    return channel->name().empty() && channel->IsOpen();
+  };
+
+  // Every local channel and the default remote channel have been opened
+  if (!local_data_channels_.empty() &&
+      std::all_of(local_data_channels_.begin(), local_data_channels_.end(), is_open) &&
+      std::any_of(remote_data_channels_.begin(), remote_data_channels_.end(), is_default_open)
     ) {
     LOG_F( INFO ) << "Peers are connected, " << remote_id_ << " and " << local_id_;
-    RTC_DCHECK( state_ == pConnecting );
  
     // Fianlly, data-channel has been opened.
     state_ = pOpen;
+    connect_time_ = rtc::TimeMillis() - initialize_time_;
     control_->OnPeerConnect(remote_id_);
     control_->OnPeerWritable(local_id_);
   }
@@ -305,13 +728,105 @@ void PeerControl::OnPeerDisconnected() {
 
 
 void PeerControl::OnPeerMessage(const webrtc::DataBuffer& buffer) {
-  string data;
-  control_->OnPeerMessage(remote_id_, buffer.data.data<char>(), buffer.data.size());
+  control_->OnPeerMessage(remote_handle_, buffer.data);
 }
 
-void PeerControl::OnBufferedAmountChange(const uint64_t previous_amount) {
-  if ( !local_data_channel_->IsWritable() ) {
-    LOG_F( LERROR ) << "local_data_channel_ is not writable";
+void PeerControl::OnPeerStripeMessage(const webrtc::DataBuffer& buffer) {
+  if (buffer.size() < kStripeHeaderSize) {
+    LOG_F( WARNING ) << "Invalid stripe chunk";
+    return;
+  }
+
+  const uint8_t* data = buffer.data.cdata();
+  const uint32_t message_id = rtc::GetBE32(data);
+  const uint32_t index = rtc::GetBE32(data + 4);
+  const uint32_t count = rtc::GetBE32(data + 8);
+  const std::size_t size = buffer.size() - kStripeHeaderSize;
+
+  // Ids wrap around, so one already delivered or skipped is far ahead too
+  if (message_id - next_stripe_receive_id_ >= kStripeReceiveWindow) {
+    LOG_F( WARNING ) << "Stripe chunk of message " << message_id
+                     << " out of the receive window at " << next_stripe_receive_id_;
+    return;
+  }
+
+  const std::size_t max_count = (MAX_STRIPE_MESSAGE_SIZE + stripe_chunk_size_ - 1) / stripe_chunk_size_;
+  if (count == 0 || count > max_count || index >= count) {
+    LOG_F( WARNING ) << "Invalid stripe chunk " << index << " of " << count;
+    return;
+  }
+
+  StripeAssembly& assembly = stripe_assemblies_[message_id];
+  if (assembly.chunks_.empty()) {
+    assembly.chunks_.resize(count);
+  }
+
+  if (assembly.chunks_.size() != count || !assembly.chunks_[index].empty() ||
+      assembly.size_ + size > MAX_STRIPE_MESSAGE_SIZE) {
+    LOG_F( WARNING ) << "Invalid stripe chunk " << index << " of " << count;
+    if (assembly.received_ == 0) stripe_assemblies_.erase(message_id);
+    return;
+  }
+
+  assembly.chunks_[index].SetData(data + kStripeHeaderSize, size);
+  assembly.size_ += size;
+  ++assembly.received_;
+
+  if (message_id == next_stripe_receive_id_) {
+    ++stripe_progress_;
+  }
+
+  DeliverStripes();
+}
+
+//
+// Emit completed striped messages in the order they were sent. A message
+// whose chunks arrived on faster channels waits for the ones before it, for
+// kStripeTimeout at most without a chunk of its own.
+//
+
+void PeerControl::DeliverStripes() {
+  auto it = stripe_assemblies_.find(next_stripe_receive_id_);
+
+  while (it != stripe_assemblies_.end() && it->second.received_ == it->second.chunks_.size()) {
+    rtc::CopyOnWriteBuffer message;
+    message.EnsureCapacity(it->second.size_);
+    for (auto& chunk : it->second.chunks_) {
+      message.AppendData(chunk);
+    }
+
+    stripe_assemblies_.erase(it);
+    ++next_stripe_receive_id_;
+    ++stripe_progress_;
+
+    control_->OnPeerMessage(remote_handle_, message);
+    it = stripe_assemblies_.find(next_stripe_receive_id_);
+  }
+
+  if (!stripe_assemblies_.empty() && !stripe_timeout_pending_) {
+    stripe_timeout_pending_ = true;
+    stripe_timeout_progress_ = stripe_progress_;
+    rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kStripeTimeout,
+                                        this, MSG_STRIPE_TIMEOUT);
+  }
+}
+
+void PeerControl::SkipStalledStripe() {
+  stripe_timeout_pending_ = false;
+
+  if (!stripe_assemblies_.empty() && stripe_progress_ == stripe_timeout_progress_) {
+    LOG_F( WARNING ) << "Skipped striped message " << next_stripe_receive_id_
+                     << ", remote_id_ is " << remote_id_;
+    stripe_assemblies_.erase(next_stripe_receive_id_);
+    ++next_stripe_receive_id_;
+    ++stripe_progress_;
+  }
+
+  DeliverStripes();
+}
+
+void PeerControl::OnPeerWritable() {
+  if ( state_ != pOpen ) {
     return;
   }
   control_->OnPeerWritable( remote_id_ );
@@ -319,24 +834,31 @@ void PeerControl::OnBufferedAmountChange(const uint64_t previous_amount) {
 
 
 bool PeerControl::CreateDataChannel(
-                    const string& label,
+                    const string& name,
                     const webrtc::DataChannelInit& init) {
 
   rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel;
 
+  string label = kDataChannelPrefix + remote_id_;
+  if (!name.empty()) {
+    label += "/" + name;
+  }
+
   data_channel = peer_connection_->CreateDataChannel(label, &init);
   if (data_channel.get() == nullptr) {
     LOG_F( LERROR ) << "data_channel is null";
     return false;
   }
 
-  local_data_channel_.reset(new PeerDataChannelObserver(data_channel));
-  if (local_data_channel_.get() == NULL) {
-    LOG_F( LERROR ) << "local_data_channel_ is null";
-    return false;
+  PeerDataChannelObserver* observer = new PeerDataChannelObserver(data_channel, name);
+  local_data_channels_.emplace_back(observer);
+  observer->set_watermarks(send_high_watermark_, send_low_watermark_);
+
+  if (observer->is_stripe()) {
+    stripe_channels_.push_back(observer);
   }
 
-  Attach(local_data_channel_.get());
+  Attach(observer);
 
   LOG_F( INFO ) << "Done";
   return true;
@@ -363,9 +885,36 @@ bool PeerControl::CreatePeerConnection() {
 
   // CreatePeerConnection with RTCConfiguration.
   webrtc::PeerConnectionInterface::RTCConfiguration config;
-  webrtc::PeerConnectionInterface::IceServer ice_server;
-  ice_server.uri = "stun:stun.l.google.com:19302";
-  config.servers.push_back(ice_server);
+
+  if (ice_.host_only_) {
+    config.tcp_candidate_policy = webrtc::PeerConnectionInterface::kTcpCandidatePolicyDisabled;
+  }
+  else {
+    for (auto& server : ice_.servers_) {
+      webrtc::PeerConnectionInterface::IceServer ice_server;
+      ice_server.urls = server.urls_;
+      ice_server.username = server.username_;
+      ice_server.password = server.credential_;
+      config.servers.push_back(ice_server);
+    }
+  }
+
+  switch (ice_.transport_policy_) {
+  case ICE_TRANSPORT_NOHOST:
+    config.type = webrtc::PeerConnectionInterface::kNoHost;
+    break;
+  case ICE_TRANSPORT_RELAY:
+    config.type = webrtc::PeerConnectionInterface::kRelay;
+    break;
+  default:
+    config.type = webrtc::PeerConnectionInterface::kAll;
+    break;
+  }
+
+  config.ice_candidate_pool_size = ice_.candidate_pool_size_;
+  config.continual_gathering_policy = ice_.continual_gathering_
+                                    ? webrtc::PeerConnectionInterface::GATHER_CONTINUALLY
+                                    : webrtc::PeerConnectionInterface::GATHER_ONCE;
 
   peer_connection_ = peer_connection_factory_->CreatePeerConnection(
     config, NULL, NULL, this);
@@ -379,17 +928,34 @@ bool PeerControl::CreatePeerConnection() {
 }
 
 void PeerControl::DeletePeerConnection() {
-  Detach(remote_data_channel_.get());
-  Detach(local_data_channel_.get());
+  for (auto& channel : remote_data_channels_) {
+    Detach(channel.get());
+  }
+  for (auto& channel : local_data_channels_) {
+    Detach(channel.get());
+  }
+
+  // A flush still queued finds no candidates
+  pending_candidates_.clear();
 
-  remote_data_channel_ = NULL;
-  local_data_channel_ = NULL;
+  stripe_channels_.clear();
+  remote_data_channels_.clear();
+  local_data_channels_.clear();
   peer_connection_ = NULL;
   peer_connection_factory_ = NULL;
 
   LOG_F( INFO ) << "Done";
 }
 
+PeerDataChannelObserver* PeerControl::LocalDataChannel(const string& name) {
+  for (auto& channel : local_data_channels_) {
+    if (channel->name() == name) {
+      return channel.get();
+    }
+  }
+  return nullptr;
+}
+
 void PeerControl::SetLocalDescription(const string& type,
                                               const string& sdp) {
 
@@ -428,7 +994,8 @@ void PeerControl::Attach(PeerDataChannelObserver* datachannel) {
   datachannel->SignalOnOpen_.connect(this, &PeerControl::OnPeerOpened);
   datachannel->SignalOnDisconnected_.connect(this, &PeerControl::OnPeerDisconnected);
   datachannel->SignalOnMessage_.connect(this, &PeerControl::OnPeerMessage);
-  datachannel->SignalOnBufferedAmountChange_.connect(this, &PeerControl::OnBufferedAmountChange);
+  datachannel->SignalOnStripeMessage_.connect(this, &PeerControl::OnPeerStripeMessage);
+  datachannel->SignalOnWritable_.connect(this, &PeerControl::OnPeerWritable);
   LOG_F( INFO ) << "Done";
 }
 
@@ -441,7 +1008,8 @@ void PeerControl::Detach(PeerDataChannelObserver* datachannel) {
   datachannel->SignalOnOpen_.disconnect(this);
   datachannel->SignalOnDisconnected_.disconnect(this);
   datachannel->SignalOnMessage_.disconnect(this);
-  datachannel->SignalOnBufferedAmountChange_.disconnect(this);
+  datachannel->SignalOnStripeMessage_.disconnect(this);
+  datachannel->SignalOnWritable_.disconnect(this);
   LOG_F( INFO ) << "Done";
 }
 
@@ -451,8 +1019,16 @@ void PeerControl::Detach(PeerDataChannelObserver* datachannel) {
 // class PeerDataChannelObserver
 //
 
-PeerDataChannelObserver::PeerDataChannelObserver(webrtc::DataChannelInterface* channel)
-  : channel_(channel) {
+PeerDataChannelObserver::PeerDataChannelObserver(webrtc::DataChannelInterface* channel,
+                                                 const std::string& name)
+  : high_watermark_(DEFAULT_SEND_HIGH_WATERMARK),
+    low_watermark_(DEFAULT_SEND_LOW_WATERMARK),
+    above_low_watermark_(false),
+    channel_(channel),
+    name_(name),
+    stripe_(channel->protocol() == kStripeProtocol),
+    signaling_thread_(rtc::Thread::Current()),
+    sent_offset_(0) {
   channel_->RegisterObserver(this);
   state_ = channel_->state();
   LOG_F( INFO ) << "Done";
@@ -462,17 +1038,26 @@ PeerDataChannelObserver::~PeerDataChannelObserver() {
   channel_->Close();
   state_ = channel_->state();
   channel_->UnregisterObserver();
+
+  // Callbacks of sends still pending run here with false, while the peer is
+  // being closed. API.md asks them not to close or send to the same peer.
+  FailSends();
   LOG_F( INFO ) << "Done";
 }
 
 void PeerDataChannelObserver::OnBufferedAmountChange(uint64_t previous_amount) {
-  SignalOnBufferedAmountChange_(previous_amount);
+  uint64_t buffered_amount = channel_->buffered_amount();
 
-  if (channel_->buffered_amount() == 0) {
-    std::lock_guard<std::mutex> lk(send_lock_);
-    send_cv_.notify_all();
+  //
+  // Emit writable as soon as the queue crosses the low watermark, so
+  // the sender refills it before the SCTP pipe runs empty.
+  //
+
+  if (buffered_amount <= low_watermark_ && above_low_watermark_.exchange(false)) {
+    SignalOnWritable_();
   }
 
+  CompleteSends();
   return;
 }
 
@@ -484,42 +1069,158 @@ void PeerDataChannelObserver::OnStateChange() {
   }
   else if (state_ == webrtc::DataChannelInterface::DataState::kClosed) {
     LOG_F( INFO ) << "Data channel internal state is kClosed";
+    FailSends();
     SignalOnDisconnected_();
   }
 }
 
 void PeerDataChannelObserver::OnMessage(const webrtc::DataBuffer& buffer) {
+  if (stripe_) {
+    SignalOnStripeMessage_(buffer);
+    return;
+  }
   SignalOnMessage_(buffer);
 }
 
-bool PeerDataChannelObserver::Send(const char* buffer, const size_t size) {
-  rtc::CopyOnWriteBuffer rtcbuffer(buffer, size);
-  webrtc::DataBuffer databuffer(rtcbuffer, true);
+bool PeerDataChannelObserver::Send(const rtc::CopyOnWriteBuffer& buffer) {
+  SendResult result = TrySend(buffer);
 
-  if ( channel_->buffered_amount() >= max_buffer_size_ ) {
+  if ( result == SEND_WOULD_BLOCK ) {
     LOG_F( LERROR ) << "Buffer is full";
-    return false;
   }
 
-  return channel_->Send(databuffer);
+  return result == SEND_OK;
+}
+
+SendResult PeerDataChannelObserver::TrySend(const rtc::CopyOnWriteBuffer& buffer) {
+  uint64_t buffered_amount = channel_->buffered_amount();
+
+  if ( buffered_amount >= high_watermark_ ) {
+    above_low_watermark_ = true;
+    return SEND_WOULD_BLOCK;
+  }
+
+  return SendData(buffer, buffered_amount, nullptr) ? SEND_OK : SEND_FAILED;
+}
+
+bool PeerDataChannelObserver::SendAsync(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback) {
+  return SendData(buffer, channel_->buffered_amount(), std::move(callback));
 }
 
-bool PeerDataChannelObserver::SyncSend(const char* buffer, const size_t size) {
-  rtc::CopyOnWriteBuffer rtcbuffer(buffer, size);
-  webrtc::DataBuffer databuffer(rtcbuffer, true);
+bool PeerDataChannelObserver::SyncSend(const rtc::CopyOnWriteBuffer& buffer) {
+  auto sent = std::make_shared<std::promise<bool>>();
+  std::future<bool> result = sent->get_future();
 
-  std::unique_lock<std::mutex> lock(send_lock_);
-  if (!channel_->Send(databuffer)) return false;
+  if (!SendAsync(buffer, [sent](bool success) { sent->set_value(success); })) {
+    return false;
+  }
 
-  if (!send_cv_.wait_for(lock, std::chrono::milliseconds(60*1000),
-                         [this] () { return channel_->buffered_amount() == 0; })) {
+  if (result.wait_for(std::chrono::milliseconds(60*1000)) != std::future_status::ready) {
     LOG_F( LERROR ) << "Buffer is full";
     return false;
   }
 
+  return result.get();
+}
+
+bool PeerDataChannelObserver::SendData(const rtc::CopyOnWriteBuffer& buffer,
+                                       uint64_t buffered_amount,
+                                       SendCallback callback) {
+
+  //
+  // Send and count the bytes on the signaling thread, where a Send() from
+  // another thread is proxied to anyway. Two threads sending at once would
+  // otherwise queue their data in one order and count it in the other.
+  //
+
+  if (!signaling_thread_->IsCurrent()) {
+    return signaling_thread_->Invoke<bool>(RTC_FROM_HERE, [&] {
+      return SendData(buffer, buffered_amount, std::move(callback));
+    });
+  }
+
+  // Mark before sending. OnBufferedAmountChange() may run before Send()
+  // returns and a missed writable event would stall the sender forever.
+  if ( buffered_amount + buffer.size() > low_watermark_ ) {
+    above_low_watermark_ = true;
+  }
+
+  // DataBuffer shares |buffer| by reference count, the payload is not copied.
+  webrtc::DataBuffer databuffer(buffer, true);
+
+  //
+  // Count the send before Send(). Send() runs OnBufferedAmountChange() once
+  // the data is queued, and a callback completed there may send again. That
+  // send is queued after this one and has to be counted after it too.
+  //
+
+  bool pending = static_cast<bool>(callback);
+  {
+    std::lock_guard<std::mutex> lock(send_lock_);
+    sent_offset_ += buffer.size();
+    if (pending) {
+      pending_sends_.push_back(PendingSend{ sent_offset_.load(), std::move(callback) });
+    }
+  }
+
+  if (!channel_->Send(databuffer)) {
+    // Nothing was queued, so nothing was sent or counted after this send
+    SendCallback failed;
+    {
+      std::lock_guard<std::mutex> lock(send_lock_);
+      sent_offset_ -= buffer.size();
+      if (pending && !pending_sends_.empty()) {
+        failed = std::move(pending_sends_.back().callback_);
+        pending_sends_.pop_back();
+      }
+    }
+    if (failed) failed(false);
+    return false;
+  }
+
+  // The data may have left the buffer before Send() returned
+  CompleteSends();
   return true;
 }
 
+void PeerDataChannelObserver::CompleteSends() {
+
+  //
+  // Read sent_offset_ before buffered_amount(). Bytes sent in between are
+  // counted in buffered_amount() only, so a send can complete late but
+  // never before its data has left the buffer.
+  //
+
+  uint64_t sent_offset = sent_offset_.load();
+  uint64_t buffered_amount = channel_->buffered_amount();
+  uint64_t acked_offset = sent_offset > buffered_amount ? sent_offset - buffered_amount : 0;
+
+  std::vector<SendCallback> completed;
+  {
+    std::lock_guard<std::mutex> lock(send_lock_);
+    while (!pending_sends_.empty() && pending_sends_.front().end_offset_ <= acked_offset) {
+      completed.push_back(std::move(pending_sends_.front().callback_));
+      pending_sends_.pop_front();
+    }
+  }
+
+  for (auto& callback : completed) {
+    callback(true);
+  }
+}
+
+void PeerDataChannelObserver::FailSends() {
+  std::deque<PendingSend> failed;
+  {
+    std::lock_guard<std::mutex> lock(send_lock_);
+    failed.swap(pending_sends_);
+  }
+
+  for (auto& pending : failed) {
+    pending.callback_(false);
+  }
+}
+
 void PeerDataChannelObserver::Close() {
   LOG_F(LS_INFO) << "Closing data channel";
   if (channel_->state() != webrtc::DataChannelInterface::kClosing) {
@@ -547,12 +1248,7 @@ bool PeerDataChannelObserver::IsWritable() {
     return false;
   }
 
-  if ( channel_->buffered_amount() > 0 ) {
-    LOG_F( LERROR ) << "buffer is full";
-    return false;
-  }
-
-  return true;
+  return channel_->buffered_amount() < high_watermark_;
 }
 
 
@@ -7,16 +7,23 @@
 #ifndef __PEERAPI_PEER_H__
 #define __PEERAPI_PEER_H__
 
-#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <memory>
+#include <vector>
 #include "api/data_channel_interface.h"
 #include "api/peer_connection_interface.h"
 #include "api/scoped_refptr.h"
 #include "api/jsep.h"
+#include "rtc_base/copy_on_write_buffer.h"
+#include "rtc_base/message_handler.h"
 #include "rtc_base/strings/json.h"
+#include "rtc_base/thread.h"
 #include "sdk/media_constraints.h"
 #include "common.h"
+#include "signalcommand.h"
 
 namespace peerapi {
 
@@ -26,11 +33,11 @@ namespace peerapi {
 
 class PeerObserver {
 public:
-  virtual void SendCommand(const std::string& peer_id, const std::string& command, const Json::Value& data) = 0;
+  virtual void SendCommand(const SignalCommand& command) = 0;
   virtual void ClosePeer(const std::string peer_id, const peerapi::CloseCode code, bool force_queuing = FORCE_QUEUING_OFF ) = 0;
   virtual void OnPeerConnect(const std::string peer_id) = 0;
   virtual void OnPeerClose(const std::string peer_id, const peerapi::CloseCode code) = 0;
-  virtual void OnPeerMessage(const std::string& peer_id, const char* buffer, const size_t size) = 0;
+  virtual void OnPeerMessage(const PeerHandle& peer, const rtc::CopyOnWriteBuffer& buffer) = 0;
   virtual void OnPeerWritable(const std::string& peer_id) = 0;
 };
 
@@ -44,11 +51,13 @@ class PeerDataChannelObserver;
 class PeerControl
       : public webrtc::CreateSessionDescriptionObserver,
         public webrtc::PeerConnectionObserver,
-        public sigslot::has_slots<> {
+        public sigslot::has_slots<>,
+        public rtc::MessageHandler {
 
 public:
 
   using string = std::string;
+  using DataChannelList = std::vector<std::unique_ptr<PeerDataChannelObserver>>;
 
   explicit PeerControl(const string local_session_id,
                        const string remote_session_id,
@@ -67,16 +76,30 @@ public:
 
   const string& local_id() const { return local_id_; }
   const string& remote_id() const { return remote_id_; }
+  const PeerHandle& remote_handle() const { return remote_handle_; }
   const PeerState state() const { return state_ ; }
 
+  void set_send_watermarks(uint64_t high, uint64_t low) { send_high_watermark_ = high; send_low_watermark_ = low; }
+  void set_channels(const ChannelSettings& channels, std::size_t stripe_chunk_size) { channels_ = channels; stripe_chunk_size_ = stripe_chunk_size; }
+  void set_candidate_batch_delay(int delay) { candidate_batch_delay_ = delay; }
+  void set_ice(const IceSetting& ice) { ice_ = ice; }
+  void set_remote_id(const string& remote_id) { remote_id_ = remote_id; remote_handle_ = PeerHandle(remote_id); }
+
   //
   // APIs
   //
 
+  bool Prepare();
   bool Initialize();
-  bool Send(const char* buffer, const size_t size);
-  bool SyncSend(const char* buffer, const size_t size);
+  bool Send(const rtc::CopyOnWriteBuffer& buffer);
+  bool SyncSend(const rtc::CopyOnWriteBuffer& buffer);
+  SendResult TrySend(const rtc::CopyOnWriteBuffer& buffer);
+  bool SendAsync(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback);
+  SendResult TrySend(const string& channel, const rtc::CopyOnWriteBuffer& buffer);
+  bool SendAsync(const string& channel, const rtc::CopyOnWriteBuffer& buffer, SendCallback callback);
+  bool SendStriped(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback);
   bool IsWritable();
+  void GetStats(StatsCallback callback);
   void Close(const CloseCode code);
 
   //
@@ -100,7 +123,7 @@ public:
   void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel) override;
   void OnRenegotiationNeeded() override {}
   void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state) override; 
-  void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state) override {}
+  void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state) override;
   void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override;
   void OnIceConnectionReceivingChange(bool receiving) override {}
 
@@ -118,14 +141,42 @@ public:
   void OnPeerOpened();
   void OnPeerDisconnected();
   void OnPeerMessage(const webrtc::DataBuffer& buffer);
-  void OnBufferedAmountChange(const uint64_t previous_amount);
+  void OnPeerStripeMessage(const webrtc::DataBuffer& buffer);
+  void OnPeerWritable();
+
+  //
+  // Implements MessageHandler
+  //
+
+  void OnMessage(rtc::Message* msg) override;
 
 protected:
 
+  enum {
+    MSG_FLUSH_CANDIDATES,           // Send local candidates gathered so far
+    MSG_ICE_RESTART,                // Restart ICE of a disconnected peer
+    MSG_ICE_TIMEOUT,                // Close a peer not connected again
+    MSG_STRIPE_TIMEOUT              // Skip a striped message that stalls the rest
+  };
+
+  // Chunks of one SendStriped() message received so far
+  struct StripeAssembly {
+    std::vector<rtc::CopyOnWriteBuffer> chunks_;
+    std::size_t received_ = 0;
+    std::size_t size_ = 0;
+  };
+
   bool CreatePeerConnection();
   void DeletePeerConnection();
-  bool CreateDataChannel(const string& label,
+  bool CreateDataChannel(const string& name,
                          const webrtc::DataChannelInit& init);
+  PeerDataChannelObserver* LocalDataChannel(const string& name);
+  void DeliverStripes();
+  void SkipStalledStripe();
+  void FlushIceCandidates();
+  void WaitForIceRestart();
+  void CancelIceRestart();
+  void RestartIce();
   void SetLocalDescription(const string& type, const string& sdp);
   void SetRemoteDescription(const string& type, const string& sdp);
   void Attach(PeerDataChannelObserver* datachannel);
@@ -136,11 +187,49 @@ protected:
 
   string local_id_;
   string remote_id_;
-  std::unique_ptr<PeerDataChannelObserver> local_data_channel_;
-  std::unique_ptr<PeerDataChannelObserver> remote_data_channel_;
+  PeerHandle remote_handle_;
+
+  // The default channel is the first of local_data_channels_, followed by
+  // one channel for each of channels_.
+  DataChannelList local_data_channels_;
+  DataChannelList remote_data_channels_;
+  ChannelSettings channels_;
+
+  // Local stripe channels in the order chunks are sent on them, and
+  // received messages waiting for their chunks or for an earlier message.
+  // stripe_progress_ counts chunks of the message next_stripe_receive_id_
+  // and messages delivered, so a timeout can tell a lost message from a
+  // slow one.
+  std::vector<PeerDataChannelObserver*> stripe_channels_;
+  std::size_t stripe_chunk_size_;
+  std::size_t next_stripe_channel_;
+  uint32_t next_stripe_send_id_;
+  uint32_t next_stripe_receive_id_;
+  std::map<uint32_t, StripeAssembly> stripe_assemblies_;
+  uint64_t stripe_progress_;
+  uint64_t stripe_timeout_progress_;
+  bool stripe_timeout_pending_;
+
+  // Local candidates waiting for the batch delay or the end of gathering
+  int candidate_batch_delay_;
+  std::vector<IceCandidateData> pending_candidates_;
+
+  IceSetting ice_;
+
+  // offerer_ is true if this peer made the first offer, and restarts ICE.
+  // ice_disconnected_ is true while waiting for the ICE connection again.
+  bool offerer_;
+  bool ice_disconnected_;
+
+  // rtc::TimeMillis() when initialized, and milliseconds taken to open
+  int64_t initialize_time_;
+  int64_t connect_time_;
 
   PeerState state_;
 
+  uint64_t send_high_watermark_;
+  uint64_t send_low_watermark_;
+
   PeerObserver* control_;
 
 };
@@ -152,36 +241,68 @@ protected:
 
 class PeerDataChannelObserver : public webrtc::DataChannelObserver {
 public:
-  explicit PeerDataChannelObserver(webrtc::DataChannelInterface* channel);
+  explicit PeerDataChannelObserver(webrtc::DataChannelInterface* channel, const std::string& name);
   virtual ~PeerDataChannelObserver();
 
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer& buffer) override;
   void OnBufferedAmountChange(uint64_t previous_amount) override;
 
-  bool Send(const char* buffer, const size_t size);
-  bool SyncSend(const char* buffer, const size_t size);
+  bool Send(const rtc::CopyOnWriteBuffer& buffer);
+  bool SyncSend(const rtc::CopyOnWriteBuffer& buffer);
+  SendResult TrySend(const rtc::CopyOnWriteBuffer& buffer);
+  bool SendAsync(const rtc::CopyOnWriteBuffer& buffer, SendCallback callback);
   void Close();
   bool IsOpen() const;
   uint64_t BufferedAmount();
   bool IsWritable();
   const webrtc::DataChannelInterface::DataState state() const;
 
+  // name() is empty for the default channel of a peer
+  const std::string& name() const { return name_; }
+  bool is_stripe() const { return stripe_; }
+
+  void set_watermarks(uint64_t high, uint64_t low) { high_watermark_ = high; low_watermark_ = low; }
+
   // sigslots
   sigslot::signal0<> SignalOnOpen_;
   sigslot::signal0<> SignalOnDisconnected_;
   sigslot::signal1<const webrtc::DataBuffer&> SignalOnMessage_;
-  sigslot::signal1<const uint64_t> SignalOnBufferedAmountChange_;
+  sigslot::signal1<const webrtc::DataBuffer&> SignalOnStripeMessage_;
+  sigslot::signal0<> SignalOnWritable_;
 
 protected:
 
 private:
 
-  const size_t max_buffer_size_ = 16 * 1024 * 1024;
+  struct PendingSend {
+    uint64_t end_offset_;
+    SendCallback callback_;
+  };
+
+  bool SendData(const rtc::CopyOnWriteBuffer& buffer, uint64_t buffered_amount, SendCallback callback);
+  void CompleteSends();
+  void FailSends();
+
+  // TrySend() returns SEND_WOULD_BLOCK and Send() returns false above
+  // high_watermark_. SignalOnWritable_ is emitted when buffered amount falls
+  // to low_watermark_ after it was above it.
+  uint64_t high_watermark_;
+  uint64_t low_watermark_;
+  std::atomic<bool> above_low_watermark_;
 
   rtc::scoped_refptr<webrtc::DataChannelInterface> channel_;
   webrtc::DataChannelInterface::DataState state_;
-  std::condition_variable send_cv_;
+  std::string name_;
+  bool stripe_;
+
+  // sent_offset_ counts every byte accepted by channel_. A send completes
+  // when sent_offset_ - buffered_amount() passes its own end offset. Sends
+  // are made and counted on signaling_thread_, the thread the channel was
+  // created on, so the offsets follow the order of the channel's queue.
+  rtc::Thread* signaling_thread_;
+  std::atomic<uint64_t> sent_offset_;
+  std::deque<PendingSend> pending_sends_;
   std::mutex send_lock_;
 };
 
@@ -43,7 +43,11 @@ Peer::~Peer() {
 }
 
 void Peer::Run() {
-  rtc::ThreadManager::Instance()->CurrentThread()->Run();
+  rtc::Thread* thread = rtc::ThreadManager::Instance()->CurrentThread();
+
+  // Clear a previous Stop(), so peers can be run again on this thread
+  thread->Restart();
+  thread->Run();
   LOG_F( INFO ) << "Done";
 }
 
@@ -66,6 +70,11 @@ void Peer::Open() {
 
   if ( signal_ == nullptr ) {
     signal_ = std::make_shared<peerapi::Signal>( setting_.signal_uri_ );
+    signal_->set_reconnect_attempts( setting_.signal_reconnect_attempts_ );
+    signal_->set_reconnect_delay_max( setting_.signal_reconnect_delay_max_ );
+    signal_->set_reconnect_delay( setting_.signal_reconnect_delay_ );
+    signal_->set_binary( setting_.signal_binary_ );
+    signal_->set_compression( setting_.signal_compression_ );
   }
 
   //
@@ -74,6 +83,21 @@ void Peer::Open() {
 
   control_ = std::make_shared<peerapi::Control>( signal_ );
   control_->RegisterObserver( this, control_ );
+  control_->set_send_watermarks( setting_.send_high_watermark_, setting_.send_low_watermark_ );
+  control_->set_dedicated_threads( setting_.dedicated_threads_ );
+  control_->set_shared_factory( setting_.shared_factory_ );
+  control_->set_channels( setting_.channels_, setting_.stripe_chunk_size_ );
+  control_->set_candidate_batch_delay( setting_.candidate_batch_delay_ );
+  control_->set_peer_pool_size( setting_.peer_pool_size_ );
+  control_->set_ice( setting_.ice_ );
+  control_->set_stats_interval( setting_.stats_interval_ );
+
+  if ( setting_.receive_queue_size_ > 0 ) {
+    if ( receive_queue_ == nullptr ) {
+      receive_queue_ = std::make_shared<ReceiveQueue>( setting_.receive_queue_size_ );
+    }
+    control_->set_receive_queue( receive_queue_, setting_.receive_overflow_ );
+  }
 
   if ( control_.get() == NULL ) {
     LOG_F( LERROR ) << "Failed to create class Control.";
@@ -122,6 +146,19 @@ void Peer::Connect( const string peer_id ) {
 //
 
 bool Peer::Send( const string& peer_id, const char* data, const size_t size, const bool wait ) {
+  return Send( peer_id, Buffer( data, size ), wait );
+}
+
+bool Peer::Send( const string& peer_id, const string& message, const bool wait  ) {
+  return Send( peer_id, message.c_str(), message.size(), wait );
+}
+
+//
+// Send a ref-counted buffer without copying its payload. The same Buffer
+// can be passed to several peers and they all share one copy of the bytes.
+//
+
+bool Peer::Send( const string& peer_id, const Buffer& data, const bool wait ) {
   if ( wait ) {
 
     //
@@ -129,10 +166,10 @@ bool Peer::Send( const string& peer_id, const char* data, const size_t size, con
     // and a timeout is 60*1000 ms by default.
     //
 
-    return control_->SyncSend( peer_id, data, size );
+    return control_->SyncSend( peer_id, data.rtc_buffer() );
   }
   else {
-    control_->Send( peer_id, data, size );
+    control_->Send( peer_id, data.rtc_buffer() );
 
     //
     // Asyncronous send always returns true and
@@ -143,8 +180,147 @@ bool Peer::Send( const string& peer_id, const char* data, const size_t size, con
   }
 }
 
-bool Peer::Send( const string& peer_id, const string& message, const bool wait  ) {
-  return Send( peer_id, message.c_str(), message.size(), wait );
+//
+// Send without blocking and report why a data was not sent. It returns
+// SEND_WOULD_BLOCK if the peer buffers more than the high watermark,
+// a 'writable' event will be emitted when it drains below the low watermark.
+//
+
+SendResult Peer::TrySend( const string& peer_id, const char* data, const size_t size ) {
+  return TrySend( peer_id, Buffer( data, size ) );
+}
+
+SendResult Peer::TrySend( const string& peer_id, const Buffer& data ) {
+  return control_->TrySend( peer_id, data.rtc_buffer() );
+}
+
+//
+// Send without blocking the caller. Completion is reported when the data
+// has left the send buffer of the data channel, or with false if the
+// peer is closed first. Many sends can be in flight at once.
+//
+
+std::future<bool> Peer::SendAsync( const string& peer_id, const char* data, const size_t size ) {
+  return SendAsync( peer_id, Buffer( data, size ) );
+}
+
+std::future<bool> Peer::SendAsync( const string& peer_id, const Buffer& data ) {
+  auto sent = std::make_shared<std::promise<bool>>();
+  std::future<bool> result = sent->get_future();
+
+  SendAsync( peer_id, data, [sent]( bool success ) {
+    sent->set_value( success );
+  });
+
+  return result;
+}
+
+void Peer::SendAsync( const string& peer_id, const Buffer& data, SendCallback callback ) {
+  control_->SendAsync( peer_id, data.rtc_buffer(), std::move( callback ) );
+}
+
+//
+// Send on a channel opened with the "channels" option. An empty channel
+// name is the default channel used by Send(), TrySend() and SendAsync().
+//
+
+SendResult Peer::TrySend( const string& peer_id, const string& channel, const Buffer& data ) {
+  return control_->TrySend( peer_id, channel, data.rtc_buffer() );
+}
+
+std::future<bool> Peer::SendAsync( const string& peer_id, const string& channel, const Buffer& data ) {
+  auto sent = std::make_shared<std::promise<bool>>();
+  std::future<bool> result = sent->get_future();
+
+  SendAsync( peer_id, channel, data, [sent]( bool success ) {
+    sent->set_value( success );
+  });
+
+  return result;
+}
+
+void Peer::SendAsync( const string& peer_id, const string& channel, const Buffer& data, SendCallback callback ) {
+  control_->SendAsync( peer_id, channel, data.rtc_buffer(), std::move( callback ) );
+}
+
+//
+// Spread one large message over every channel opened with "stripe": true.
+// The remote peer receives it as a single 'message' event, in the order
+// of other striped messages.
+//
+
+std::future<bool> Peer::SendStriped( const string& peer_id, const Buffer& data ) {
+  auto sent = std::make_shared<std::promise<bool>>();
+  std::future<bool> result = sent->get_future();
+
+  SendStriped( peer_id, data, [sent]( bool success ) {
+    sent->set_value( success );
+  });
+
+  return result;
+}
+
+void Peer::SendStriped( const string& peer_id, const Buffer& data, SendCallback callback ) {
+  control_->SendStriped( peer_id, data.rtc_buffer(), std::move( callback ) );
+}
+
+//
+// Send one payload to many peers. The buffer is built once and shared by
+// every data channel. A peer whose send buffer is full is skipped with
+// SEND_WOULD_BLOCK instead of failing the others.
+//
+
+SendResults Peer::Broadcast( const char* data, const size_t size, const PeerFilter& filter ) {
+  return Broadcast( Buffer( data, size ), filter );
+}
+
+SendResults Peer::Broadcast( const Buffer& data, const PeerFilter& filter ) {
+  return control_->Broadcast( data.rtc_buffer(), filter );
+}
+
+SendResults Peer::Multicast( const std::vector<string>& peer_ids, const char* data, const size_t size ) {
+  return Multicast( peer_ids, Buffer( data, size ) );
+}
+
+SendResults Peer::Multicast( const std::vector<string>& peer_ids, const Buffer& data ) {
+  return control_->Multicast( peer_ids, data.rtc_buffer() );
+}
+
+//
+// Read transport statistics of a connected peer. |callback| runs on the
+// thread of Peer::Run() with false if the peer is not open.
+//
+
+void Peer::GetStats( const string& peer_id, StatsCallback callback ) {
+  if ( control_ == nullptr ) {
+    PeerStats stats;
+    stats.peer_id_ = peer_id;
+    if ( callback ) callback( false, stats );
+    return;
+  }
+
+  control_->GetStats( peer_id, std::move( callback ) );
+}
+
+//
+// Emit 'message' events of queued messages on the calling thread, at most
+// |max_messages| of them or all if 0. Returns the number emitted. Only one
+// thread at a time may call Poll() of a Peer, and not the thread running
+// Peer::Run(), which a full queue blocks with RECEIVE_BLOCK.
+//
+
+std::size_t Peer::Poll( const std::size_t max_messages ) {
+  if ( receive_queue_ == nullptr ) return 0;
+
+  std::size_t count = 0;
+  ReceivedMessage message;
+
+  while ( ( max_messages == 0 || count < max_messages ) && receive_queue_->Pop( message ) ) {
+    OnMessage( message.peer_, message.data_.data<char>(), message.data_.size() );
+    ++count;
+  }
+
+  return count;
 }
 
 bool Peer::SetOptions( const string options ) {
@@ -168,14 +344,22 @@ Peer& Peer::On( string event_id, std::function<void( string )> handler ) {
 
   if ( event_id.empty() ) return *this;
 
-  if ( event_id == "open" || event_id == "connect" || event_id == "writable" ) {
-    std::unique_ptr<EventHandler_2> f( new EventHandler_2( handler ) );
-    event_handler_.insert( Events::value_type( event_id, std::move( f ) ) );
-    LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
-  }
-  else {
+  switch ( ToEventType( event_id ) ) {
+  case EVENT_OPEN:
+    events_.open_ = handler;
+    break;
+  case EVENT_CONNECT:
+    events_.connect_ = handler;
+    break;
+  case EVENT_WRITABLE:
+    events_.writable_ = handler;
+    break;
+  default:
     LOG_F( LERROR ) << "Unsupported event type: " << event_id;
+    return *this;
   }
+
+  LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
   return *this;
 }
 
@@ -190,10 +374,8 @@ Peer& Peer::On( string event_id, std::function<void( string, string )> handler )
 Peer& Peer::On( string event_id, std::function<void( string, peerapi::CloseCode, string )> handler ) {
   if ( event_id.empty() ) return *this;
 
-  if ( event_id == "close" ) {
-    std::unique_ptr<EventHandler_Close> f( new EventHandler_Close( handler ) );
-    event_handler_.insert( Events::value_type( event_id, std::move( f ) ) );
-
+  if ( ToEventType( event_id ) == EVENT_CLOSE ) {
+    events_.close_ = handler;
     LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
   }
   else {
@@ -206,10 +388,41 @@ Peer& Peer::On( string event_id, std::function<void( string, peerapi::CloseCode,
 Peer& Peer::On( string event_id, std::function<void( string, char*, std::size_t )> handler ) {
   if ( event_id.empty() ) return *this;
 
-  if ( event_id == "message" ) {
-    std::unique_ptr<EventHandler_Message> f( new EventHandler_Message( handler ) );
-    event_handler_.insert( Events::value_type( event_id, std::move( f ) ) );
+  if ( ToEventType( event_id ) == EVENT_MESSAGE ) {
+    events_.message_ = handler;
+    LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
+  }
+  else {
+    LOG_F( LERROR ) << "Unsupported event type: " << event_id;
+  }
+
+  return *this;
+}
+
+//
+// A "message" handler taking PeerHandle receives the id of remote peer
+// without copying it.
+//
+
+Peer& Peer::On( string event_id, std::function<void( const PeerHandle&, char*, std::size_t )> handler ) {
+  if ( event_id.empty() ) return *this;
+
+  if ( ToEventType( event_id ) == EVENT_MESSAGE ) {
+    events_.message_handle_ = handler;
+    LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
+  }
+  else {
+    LOG_F( LERROR ) << "Unsupported event type: " << event_id;
+  }
+
+  return *this;
+}
+
+Peer& Peer::On( string event_id, std::function<void( const PeerStats& )> handler ) {
+  if ( event_id.empty() ) return *this;
 
+  if ( ToEventType( event_id ) == EVENT_STATS ) {
+    events_.stats_ = handler;
     LOG_F( INFO ) << "An event handler '" << event_id << "' has been inserted";
   }
   else {
@@ -219,6 +432,16 @@ Peer& Peer::On( string event_id, std::function<void( string, char*, std::size_t
   return *this;
 }
 
+Peer::EventType Peer::ToEventType( const string& event_id ) {
+  if ( event_id == "open" ) return EVENT_OPEN;
+  if ( event_id == "close" ) return EVENT_CLOSE;
+  if ( event_id == "connect" ) return EVENT_CONNECT;
+  if ( event_id == "message" ) return EVENT_MESSAGE;
+  if ( event_id == "writable" ) return EVENT_WRITABLE;
+  if ( event_id == "stats" ) return EVENT_STATS;
+  return EVENT_UNKNOWN;
+}
+
 //
 // Signal event handler
 //
@@ -226,8 +449,8 @@ Peer& Peer::On( string event_id, std::function<void( string, char*, std::size_t
 void Peer::OnOpen( const string peer_id ) {
   close_once_ = false;
 
-  if ( event_handler_.find( "open" ) != event_handler_.end() ) {
-    CallEventHandler( "open", peer_id );
+  if ( events_.open_ ) {
+    events_.open_( peer_id );
   }
 
   LOG_F( INFO ) << "Done";
@@ -244,8 +467,8 @@ void Peer::OnClose( const string peer_id, const CloseCode code, const string des
 
     close_once_ = true;
 
-    if ( event_handler_.find( "close" ) != event_handler_.end() ) {
-      CallEventHandler( "close", peer_id, code, desc );
+    if ( events_.close_ ) {
+      events_.close_( peer_id, code, desc );
     }
 
     control_->UnregisterObserver();
@@ -253,8 +476,8 @@ void Peer::OnClose( const string peer_id, const CloseCode code, const string des
   }
   // Remote peer has been closed
   else {
-    if ( event_handler_.find( "close" ) != event_handler_.end() ) {
-      CallEventHandler( "close", peer_id, code, desc );
+    if ( events_.close_ ) {
+      events_.close_( peer_id, code, desc );
     }
   }
 
@@ -262,38 +485,201 @@ void Peer::OnClose( const string peer_id, const CloseCode code, const string des
 }
 
 void Peer::OnConnect( const string peer_id ) {
-  if ( event_handler_.find( "connect" ) != event_handler_.end() ) {
-    CallEventHandler( "connect", peer_id );
+  if ( events_.connect_ ) {
+    events_.connect_( peer_id );
   }
 
   LOG_F( INFO ) << "Done, peer is " << peer_id;
 }
 
-void Peer::OnMessage( const string peer_id, const char* data, const size_t size ) {
-  if ( event_handler_.find( "message" ) != event_handler_.end() ) {
-    CallEventHandler( "message", peer_id, data, size );
+void Peer::OnMessage( const PeerHandle& peer, const char* data, const size_t size ) {
+  if ( events_.message_handle_ ) {
+    events_.message_handle_( peer, const_cast<char*>( data ), size );
+  }
+
+  if ( events_.message_ ) {
+    events_.message_( peer.id(), const_cast<char*>( data ), size );
   }
 }
 
 void Peer::OnWritable( const string peer_id ) {
-  if ( event_handler_.find( "writable" ) != event_handler_.end() ) {
-    CallEventHandler( "writable", peer_id );
+  if ( events_.writable_ ) {
+    events_.writable_( peer_id );
   }
 
   LOG_F( INFO ) << "Done, peer is " << peer_id;
 }
 
+void Peer::OnStats( const PeerStats& stats ) {
+  if ( events_.stats_ ) {
+    events_.stats_( stats );
+  }
+}
+
+
+namespace {
+
+//
+// Read a byte count of up to 64 bits, which rtc::GetIntFromJsonObject()
+// can not. Returns false if |key| is there and is not a non-negative integer.
+//
+
+bool ParseByteCount( const Json::Value& options, const char* key, uint64_t& count, bool& found ) {
+  Json::Value value;
+  found = rtc::GetValueFromJsonObject( options, key, &value );
+  if ( !found ) {
+    return true;
+  }
+
+  if ( !value.isUInt64() ) {
+    LOG_F( WARNING ) << "Invalid " << key << ": " << value.toStyledString();
+    return false;
+  }
+
+  count = value.asUInt64();
+  return true;
+}
+
+//
+// "ice_servers": [ { "urls": "stun:stun.example.org" },
+//                  { "urls": [ "turn:turn.example.org" ], "username": "user", "credential": "secret" } ]
+// "ice_transport_policy": "all", "nohost" or "relay"
+// "ice_candidate_pool_size": 0
+// "continual_gathering": false
+// "host_only": false
+// "ice_restart_grace": 0
+//
+
+bool ParseIceOptions( const Json::Value& options, IceSetting& ice ) {
+  Json::Value servers;
+  string value;
+
+  if ( rtc::GetValueFromJsonObject( options, "ice_servers", &servers ) ) {
+    if ( !servers.isArray() ) {
+      LOG_F( WARNING ) << "Invalid ice_servers: " << servers.toStyledString();
+      return false;
+    }
+
+    std::vector<IceServerSetting> settings;
+    for ( Json::Value::ArrayIndex i = 0; i < servers.size(); ++i ) {
+      IceServerSetting server;
+      Json::Value urls;
+
+      if ( rtc::GetStringFromJsonObject( servers[i], "urls", &value ) ) {
+        server.urls_.push_back( value );
+      }
+      else if ( rtc::GetValueFromJsonObject( servers[i], "urls", &urls ) &&
+                urls.isArray() && urls.size() > 0 ) {
+        if ( !rtc::JsonArrayToStringVector( urls, &server.urls_ ) ) {
+          LOG_F( WARNING ) << "Invalid urls: " << urls.toStyledString();
+          return false;
+        }
+      }
+      else {
+        LOG_F( WARNING ) << "Invalid ice server: " << servers[i].toStyledString();
+        return false;
+      }
+
+      rtc::GetStringFromJsonObject( servers[i], "username", &server.username_ );
+      rtc::GetStringFromJsonObject( servers[i], "credential", &server.credential_ );
+      settings.push_back( server );
+    }
+
+    ice.servers_ = settings;
+  }
+
+  if ( rtc::GetStringFromJsonObject( options, "ice_transport_policy", &value ) ) {
+    if ( value == "all" ) {
+      ice.transport_policy_ = ICE_TRANSPORT_ALL;
+    }
+    else if ( value == "nohost" ) {
+      ice.transport_policy_ = ICE_TRANSPORT_NOHOST;
+    }
+    else if ( value == "relay" ) {
+      ice.transport_policy_ = ICE_TRANSPORT_RELAY;
+    }
+    else {
+      LOG_F( WARNING ) << "Invalid ice_transport_policy: " << value;
+      return false;
+    }
+  }
+
+  int pool_size;
+  if ( rtc::GetIntFromJsonObject( options, "ice_candidate_pool_size", &pool_size ) ) {
+    if ( pool_size < 0 ) {
+      LOG_F( WARNING ) << "Invalid ice_candidate_pool_size: " << pool_size;
+      return false;
+    }
+    ice.candidate_pool_size_ = pool_size;
+  }
+
+  rtc::GetBoolFromJsonObject( options, "continual_gathering", &ice.continual_gathering_ );
+  rtc::GetBoolFromJsonObject( options, "host_only", &ice.host_only_ );
+
+  int restart_grace;
+  if ( rtc::GetIntFromJsonObject( options, "ice_restart_grace", &restart_grace ) ) {
+    if ( restart_grace < 0 ) {
+      LOG_F( WARNING ) << "Invalid ice_restart_grace: " << restart_grace;
+      return false;
+    }
+    ice.restart_grace_ = restart_grace;
+  }
+
+  // Host candidates are all that a host only peer has
+  if ( ice.host_only_ && ice.transport_policy_ != ICE_TRANSPORT_ALL ) {
+    LOG_F( WARNING ) << "host_only needs ice_transport_policy \"all\"";
+    return false;
+  }
+
+  return true;
+}
+
+//
+// "signal_compression": true, or an object of
+// { "window_bits": 15, "server_window_bits": 15, "memory_level": 4,
+//   "no_context_takeover": false, "server_no_context_takeover": false }
+//
+
+bool ParseSignalCompression( const Json::Value& options, SignalCompressionSetting& compression ) {
+  Json::Value value;
+  if ( !rtc::GetValueFromJsonObject( options, "signal_compression", &value ) ) {
+    return true;
+  }
+
+  if ( value.isBool() ) {
+    compression = SignalCompressionSetting();
+    compression.enabled_ = value.asBool();
+    return true;
+  }
+
+  if ( !value.isObject() ) {
+    LOG_F( WARNING ) << "Invalid signal_compression: " << value.toStyledString();
+    return false;
+  }
+
+  SignalCompressionSetting setting;
+  setting.enabled_ = true;
+
+  rtc::GetIntFromJsonObject( value, "window_bits", &setting.client_max_window_bits_ );
+  rtc::GetIntFromJsonObject( value, "server_window_bits", &setting.server_max_window_bits_ );
+  rtc::GetIntFromJsonObject( value, "memory_level", &setting.memory_level_ );
+  rtc::GetBoolFromJsonObject( value, "no_context_takeover", &setting.client_no_context_takeover_ );
+  rtc::GetBoolFromJsonObject( value, "server_no_context_takeover", &setting.server_no_context_takeover_ );
+
+  // zlib writes no raw deflate stream with a window of 8 bits, which the
+  // WebSocket extension would allow
+  if ( setting.client_max_window_bits_ < 9 || setting.client_max_window_bits_ > 15 ||
+       setting.server_max_window_bits_ < 9 || setting.server_max_window_bits_ > 15 ||
+       setting.memory_level_ < 1 || setting.memory_level_ > 9 ) {
+    LOG_F( WARNING ) << "Invalid signal_compression: " << value.toStyledString();
+    return false;
+  }
 
-template<typename ...A>
-void Peer::CallEventHandler( string msg_id, A&& ... args )
-{
-  using eventhandler_t = EventHandler_t<A...>;
-  using cb_t = std::function<void( A... )>;
-  const Handler_t& base = *event_handler_[msg_id];
-  const cb_t& func = static_cast<const eventhandler_t&>( base ).callback_;
-  func( std::forward<A>( args )... );
+  compression = setting;
+  return true;
 }
 
+} // namespace
 
 bool Peer::ParseOptions( const string& options ) {
   Json::Reader reader;
@@ -318,6 +704,205 @@ bool Peer::ParseOptions( const string& options ) {
     setting_.signal_password_ = value;
   }
 
+  uint64_t high_watermark = setting_.send_high_watermark_;
+  uint64_t low_watermark = setting_.send_low_watermark_;
+  bool high_found;
+  bool low_found;
+
+  if ( !ParseByteCount( joptions, "send_high_watermark", high_watermark, high_found ) ||
+       !ParseByteCount( joptions, "send_low_watermark", low_watermark, low_found ) ) {
+    return false;
+  }
+
+  // A high watermark given alone lowers the low one to it
+  if ( high_found && !low_found && low_watermark > high_watermark ) {
+    low_watermark = high_watermark;
+  }
+
+  if ( high_watermark == 0 || low_watermark > high_watermark ) {
+    LOG_F( WARNING ) << "Invalid send watermarks: " << high_watermark << ", " << low_watermark;
+    return false;
+  }
+
+  setting_.send_high_watermark_ = high_watermark;
+  setting_.send_low_watermark_ = low_watermark;
+
+  //
+  // "single"    : WebRTC network, worker and signaling run on Peer::Run() thread
+  // "dedicated" : Network and worker threads are created for the peer, and
+  //               events are still emitted on Peer::Run() thread.
+  //
+
+  if ( rtc::GetStringFromJsonObject( joptions, "threading", &value ) ) {
+    if ( value == "single" ) {
+      setting_.dedicated_threads_ = false;
+    }
+    else if ( value == "dedicated" ) {
+      setting_.dedicated_threads_ = true;
+    }
+    else {
+      LOG_F( WARNING ) << "Invalid threading: " << value;
+      return false;
+    }
+  }
+
+  // Share a PeerConnectionFactory with other peers opened on the same thread
+  bool shared_factory;
+  if ( rtc::GetBoolFromJsonObject( joptions, "shared_factory", &shared_factory ) ) {
+    setting_.shared_factory_ = shared_factory;
+  }
+
+  //
+  // "channels": [ { "name": "control" }, { "name": "bulk", "stripe": true },
+  //               { "name": "state", "ordered": false, "max_retransmits": 0 } ]
+  //
+  // Each entry opens one more data channel to every peer. A name must be
+  // unique and must not contain '/'. A channel is either limited by
+  // retransmits or by time, and stripe channels have to be reliable.
+  //
+
+  Json::Value channels;
+  if ( rtc::GetValueFromJsonObject( joptions, "channels", &channels ) ) {
+    if ( !channels.isArray() ) {
+      LOG_F( WARNING ) << "Invalid channels: " << channels.toStyledString();
+      return false;
+    }
+
+    ChannelSettings settings;
+    for ( Json::Value::ArrayIndex i = 0; i < channels.size(); ++i ) {
+      ChannelSetting channel;
+
+      if ( !rtc::GetStringFromJsonObject( channels[i], "name", &channel.name_ ) ||
+           channel.name_.empty() || channel.name_.find( '/' ) != string::npos ) {
+        LOG_F( WARNING ) << "Invalid channel: " << channels[i].toStyledString();
+        return false;
+      }
+
+      for ( auto& other : settings ) {
+        if ( other.name_ == channel.name_ ) {
+          LOG_F( WARNING ) << "Duplicated channel: " << channel.name_;
+          return false;
+        }
+      }
+
+      rtc::GetBoolFromJsonObject( channels[i], "stripe", &channel.stripe_ );
+      rtc::GetBoolFromJsonObject( channels[i], "ordered", &channel.ordered_ );
+      rtc::GetIntFromJsonObject( channels[i], "max_retransmits", &channel.max_retransmits_ );
+      rtc::GetIntFromJsonObject( channels[i], "max_retransmit_time", &channel.max_retransmit_time_ );
+
+      const bool max_retransmits = channel.max_retransmits_ >= 0;
+      const bool max_retransmit_time = channel.max_retransmit_time_ >= 0;
+
+      if ( ( max_retransmits && max_retransmit_time ) ||
+           ( channel.stripe_ && ( max_retransmits || max_retransmit_time ) ) ) {
+        LOG_F( WARNING ) << "Invalid reliability of channel: " << channel.name_;
+        return false;
+      }
+
+      settings.push_back( channel );
+    }
+
+    setting_.channels_ = settings;
+  }
+
+  int stripe_chunk_size;
+  if ( rtc::GetIntFromJsonObject( joptions, "stripe_chunk_size", &stripe_chunk_size ) ) {
+    if ( stripe_chunk_size <= 0 || static_cast<std::size_t>( stripe_chunk_size ) > MAX_STRIPE_CHUNK_SIZE ) {
+      LOG_F( WARNING ) << "Invalid stripe_chunk_size: " << stripe_chunk_size;
+      return false;
+    }
+    setting_.stripe_chunk_size_ = stripe_chunk_size;
+  }
+
+  // Send local candidates gathered within this many milliseconds at once
+  int candidate_batch_delay;
+  if ( rtc::GetIntFromJsonObject( joptions, "candidate_batch_delay", &candidate_batch_delay ) ) {
+    if ( candidate_batch_delay < 0 || candidate_batch_delay > MAX_CANDIDATE_BATCH_DELAY ) {
+      LOG_F( WARNING ) << "Invalid candidate_batch_delay: " << candidate_batch_delay;
+      return false;
+    }
+    setting_.candidate_batch_delay_ = candidate_batch_delay;
+  }
+
+  // Peer connections prepared ahead of remote peers
+  int peer_pool_size;
+  if ( rtc::GetIntFromJsonObject( joptions, "peer_pool_size", &peer_pool_size ) ) {
+    if ( peer_pool_size < 0 || static_cast<std::size_t>( peer_pool_size ) > MAX_PEER_POOL_SIZE ) {
+      LOG_F( WARNING ) << "Invalid peer_pool_size: " << peer_pool_size;
+      return false;
+    }
+    setting_.peer_pool_size_ = peer_pool_size;
+  }
+
+  if ( !ParseIceOptions( joptions, setting_.ice_ ) ) {
+    return false;
+  }
+
+  //
+  // Reconnect to the signal server with backoff. Connected peers are kept
+  // while the signal server is not reachable.
+  //
+
+  int reconnect_attempts = setting_.signal_reconnect_attempts_;
+  int reconnect_delay = setting_.signal_reconnect_delay_;
+  int reconnect_delay_max = setting_.signal_reconnect_delay_max_;
+
+  rtc::GetIntFromJsonObject( joptions, "signal_reconnect_attempts", &reconnect_attempts );
+  rtc::GetIntFromJsonObject( joptions, "signal_reconnect_delay", &reconnect_delay );
+  rtc::GetIntFromJsonObject( joptions, "signal_reconnect_delay_max", &reconnect_delay_max );
+
+  if ( reconnect_attempts < 0 || reconnect_delay < 0 || reconnect_delay_max < reconnect_delay ) {
+    LOG_F( WARNING ) << "Invalid signal reconnection: " << reconnect_attempts << ", "
+                     << reconnect_delay << ", " << reconnect_delay_max;
+    return false;
+  }
+
+  setting_.signal_reconnect_attempts_ = reconnect_attempts;
+  setting_.signal_reconnect_delay_ = reconnect_delay;
+  setting_.signal_reconnect_delay_max_ = reconnect_delay_max;
+
+  // Offer the binary encoding of signaling commands to the signal server
+  rtc::GetBoolFromJsonObject( joptions, "signal_binary", &setting_.signal_binary_ );
+
+  if ( !ParseSignalCompression( joptions, setting_.signal_compression_ ) ) {
+    return false;
+  }
+
+  //
+  // Queue received messages for Poll() instead of emitting them on the
+  // WebRTC thread
+  //
+
+  int receive_queue_size;
+  if ( rtc::GetIntFromJsonObject( joptions, "receive_queue_size", &receive_queue_size ) ) {
+    if ( receive_queue_size < 0 || static_cast<std::size_t>( receive_queue_size ) > MAX_RECEIVE_QUEUE_SIZE ) {
+      LOG_F( WARNING ) << "Invalid receive_queue_size: " << receive_queue_size;
+      return false;
+    }
+    setting_.receive_queue_size_ = receive_queue_size;
+  }
+
+  string receive_overflow;
+  if ( rtc::GetStringFromJsonObject( joptions, "receive_queue_overflow", &receive_overflow ) ) {
+    if ( receive_overflow == "drop" ) setting_.receive_overflow_ = RECEIVE_DROP;
+    else if ( receive_overflow == "block" ) setting_.receive_overflow_ = RECEIVE_BLOCK;
+    else if ( receive_overflow == "close" ) setting_.receive_overflow_ = RECEIVE_CLOSE;
+    else {
+      LOG_F( WARNING ) << "Invalid receive_queue_overflow: " << receive_overflow;
+      return false;
+    }
+  }
+
+  // Emit a 'stats' event of every open peer this often in milliseconds
+  int stats_interval;
+  if ( rtc::GetIntFromJsonObject( joptions, "stats_interval", &stats_interval ) ) {
+    if ( stats_interval < 0 ) {
+      LOG_F( WARNING ) << "Invalid stats_interval: " << stats_interval;
+      return false;
+    }
+    setting_.stats_interval_ = stats_interval;
+  }
+
   return true;
 }
 
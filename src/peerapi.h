@@ -11,8 +11,11 @@
 #include <map>
 #include <memory>
 #include <functional>
+#include <future>
+#include <vector>
 
 #include "common.h"
+#include "buffer.h"
 #include "controlobserver.h"
 
 #ifndef USE_PEERAPI_STRICT_NAMESPACE
@@ -23,6 +26,8 @@ namespace peerapi {
 
 class Control;
 class Signal;
+struct ReceivedMessage;
+template <typename T> class SpscQueue;
 
 
 class Peer
@@ -36,6 +41,23 @@ public:
     string signal_uri_;
     string signal_id_;
     string signal_password_;
+    uint64_t send_high_watermark_ = DEFAULT_SEND_HIGH_WATERMARK;
+    uint64_t send_low_watermark_ = DEFAULT_SEND_LOW_WATERMARK;
+    bool dedicated_threads_ = false;
+    bool shared_factory_ = false;
+    ChannelSettings channels_;
+    std::size_t stripe_chunk_size_ = DEFAULT_STRIPE_CHUNK_SIZE;
+    int candidate_batch_delay_ = DEFAULT_CANDIDATE_BATCH_DELAY;
+    std::size_t peer_pool_size_ = DEFAULT_PEER_POOL_SIZE;
+    IceSetting ice_;
+    int signal_reconnect_attempts_ = DEFAULT_SIGNAL_RECONNECT_ATTEMPTS;
+    int signal_reconnect_delay_ = DEFAULT_SIGNAL_RECONNECT_DELAY;
+    int signal_reconnect_delay_max_ = DEFAULT_SIGNAL_RECONNECT_DELAY_MAX;
+    bool signal_binary_ = false;
+    SignalCompressionSetting signal_compression_;
+    int stats_interval_ = DEFAULT_STATS_INTERVAL;
+    std::size_t receive_queue_size_ = DEFAULT_RECEIVE_QUEUE_SIZE;
+    ReceiveOverflow receive_overflow_ = RECEIVE_DROP;
   };
 
   //
@@ -50,12 +72,31 @@ public:
   void Connect( const string peer_id );
   bool Send( const string& peer_id, const char* data, const std::size_t size, const bool wait = SYNC_OFF );
   bool Send( const string& peer_id, const string& data, const bool wait = SYNC_OFF );
+  bool Send( const string& peer_id, const Buffer& data, const bool wait = SYNC_OFF );
+  SendResult TrySend( const string& peer_id, const char* data, const std::size_t size );
+  SendResult TrySend( const string& peer_id, const Buffer& data );
+  std::future<bool> SendAsync( const string& peer_id, const char* data, const std::size_t size );
+  std::future<bool> SendAsync( const string& peer_id, const Buffer& data );
+  void SendAsync( const string& peer_id, const Buffer& data, SendCallback callback );
+  SendResult TrySend( const string& peer_id, const string& channel, const Buffer& data );
+  std::future<bool> SendAsync( const string& peer_id, const string& channel, const Buffer& data );
+  void SendAsync( const string& peer_id, const string& channel, const Buffer& data, SendCallback callback );
+  std::future<bool> SendStriped( const string& peer_id, const Buffer& data );
+  void SendStriped( const string& peer_id, const Buffer& data, SendCallback callback );
+  SendResults Broadcast( const char* data, const std::size_t size, const PeerFilter& filter = nullptr );
+  SendResults Broadcast( const Buffer& data, const PeerFilter& filter = nullptr );
+  SendResults Multicast( const std::vector<string>& peer_ids, const char* data, const std::size_t size );
+  SendResults Multicast( const std::vector<string>& peer_ids, const Buffer& data );
+  void GetStats( const string& peer_id, StatsCallback callback );
+  std::size_t Poll( const std::size_t max_messages = 0 );
   bool SetOptions( const string options );
 
   Peer& On( string event_id, std::function<void( string )> );
   Peer& On( string event_id, std::function<void( string, string )> );
   Peer& On( string event_id, std::function<void( string, peerapi::CloseCode, string )> );
   Peer& On( string event_id, std::function<void( string, char*, std::size_t )> );
+  Peer& On( string event_id, std::function<void( const PeerHandle&, char*, std::size_t )> );
+  Peer& On( string event_id, std::function<void( const PeerStats& )> );
 
   //
   // Member functions
@@ -68,28 +109,30 @@ public:
 
 
 protected:
-  // The base type that is stored in the collection.
-  struct Handler_t {
-    virtual ~Handler_t() = default;
-  };
 
-  // The derived type that represents a callback.
-  template<typename ...A>
-  struct EventHandler_t : public Handler_t {
-    using cb = std::function<void( A... )>;
-    cb callback_;
-    EventHandler_t( cb p_callback ) : callback_( p_callback ) {}
+  enum EventType {
+    EVENT_OPEN,
+    EVENT_CLOSE,
+    EVENT_CONNECT,
+    EVENT_MESSAGE,
+    EVENT_WRITABLE,
+    EVENT_STATS,
+    EVENT_UNKNOWN
   };
 
-  template<typename ...A>
-  void CallEventHandler( string msg_id, A&& ... args );
+  // Each event has a slot of its own type, so emitting an event is a
+  // direct call without a lookup or a cast.
+  struct Events {
+    std::function<void( string )> open_;
+    std::function<void( string, peerapi::CloseCode, string )> close_;
+    std::function<void( string )> connect_;
+    std::function<void( string, char*, std::size_t )> message_;
+    std::function<void( const PeerHandle&, char*, std::size_t )> message_handle_;
+    std::function<void( string )> writable_;
+    std::function<void( const PeerStats& )> stats_;
+  };
 
-  using EventHandler_1 = EventHandler_t<>;
-  using EventHandler_2 = EventHandler_t<string>;
-  using EventHandler_3 = EventHandler_t<string, Data&>;
-  using EventHandler_Close = EventHandler_t<string, peerapi::CloseCode, string>;
-  using EventHandler_Message = EventHandler_t<string, char*, std::size_t>;
-  using Events = std::map<string, std::unique_ptr<Handler_t>>;
+  static EventType ToEventType( const string& event_id );
 
   //
   // ControlObserver implementation
@@ -98,18 +141,23 @@ protected:
   void OnOpen( const string peer_id );
   void OnClose( const string peer_id, const peerapi::CloseCode code, const string desc = "" );
   void OnConnect( const string peer_id );
-  void OnMessage( const string peer_id, const char* data, const size_t size );
+  void OnMessage( const PeerHandle& peer, const char* data, const size_t size );
   void OnWritable( const string peer_id );
+  void OnStats( const PeerStats& stats );
 
   bool ParseOptions( const string& options );
 
   bool close_once_;
   Setting setting_;
-  Events event_handler_;
+  Events events_;
 
   std::shared_ptr<Control> control_;
   std::shared_ptr<Signal> signal_;
 
+  // Received messages waiting for Poll() if "receive_queue_size" is set.
+  // It outlives control_, so Poll() may run while the peer closes.
+  std::shared_ptr<SpscQueue<ReceivedMessage>> receive_queue_;
+
   string peer_id_;
 };
 
@@ -0,0 +1,137 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "peerfactory.h"
+#include "api/create_peerconnection_factory.h"
+
+#include "logging.h"
+
+namespace peerapi {
+
+namespace {
+
+// Shared factories by signaling thread and threading mode. Entries are
+// weak so the factory is released with the last Control using it.
+using FactoryKey = std::pair<rtc::Thread*, bool>;
+using FactoryMap = std::map<FactoryKey, std::weak_ptr<PeerFactory>>;
+
+std::mutex& SharedFactoryLock() {
+  static std::mutex lock;
+  return lock;
+}
+
+FactoryMap& SharedFactories() {
+  static FactoryMap* factories = new FactoryMap();
+  return *factories;
+}
+
+} // namespace
+
+
+PeerFactory::PeerFactory(bool dedicated_threads)
+      : dedicated_threads_(dedicated_threads),
+        signaling_thread_(rtc::Thread::Current()) {
+}
+
+PeerFactory::~PeerFactory() {
+  LOG_F( INFO ) << "Starting";
+
+  peer_connection_factory_ = NULL;
+  fake_audio_capture_module_ = NULL;
+
+  // Threads are stopped after the factory that uses them is released
+  worker_thread_.reset();
+  network_thread_.reset();
+
+  LOG_F( INFO ) << "Done";
+}
+
+std::shared_ptr<PeerFactory> PeerFactory::Create(bool dedicated_threads, bool shared) {
+
+  std::lock_guard<std::mutex> lock(SharedFactoryLock());
+
+  FactoryMap& factories = SharedFactories();
+  FactoryKey key(rtc::Thread::Current(), dedicated_threads);
+
+  if (shared) {
+    auto found = factories.find(key);
+    if (found != factories.end()) {
+      std::shared_ptr<PeerFactory> factory = found->second.lock();
+      if (factory) {
+        LOG_F( INFO ) << "Reuse shared factory";
+        return factory;
+      }
+      factories.erase(found);
+    }
+  }
+
+  std::shared_ptr<PeerFactory> factory(new PeerFactory(dedicated_threads));
+  if (!factory->Initialize()) {
+    LOG_F( LERROR ) << "Failed to initialize PeerFactory";
+    return nullptr;
+  }
+
+  if (shared) {
+    factories[key] = factory;
+  }
+
+  LOG_F( INFO ) << "Done";
+  return factory;
+}
+
+bool PeerFactory::Initialize() {
+
+  RTC_DCHECK( signaling_thread_ != nullptr );
+
+  // PeerApi only uses data channels, so the audio module never runs
+  // its 10 ms processing thread.
+  fake_audio_capture_module_ = FakeAudioCaptureModule::Create(true);
+  if (fake_audio_capture_module_ == NULL) {
+    LOG_F( LERROR ) << "Failed to create FakeAudioCaptureModule";
+    return false;
+  }
+
+  //
+  // Signaling always runs on the current thread, so that events of
+  // data channels are emitted on the thread calling Peer::Run().
+  //
+
+  rtc::Thread* network_thread = signaling_thread_;
+  rtc::Thread* worker_thread = signaling_thread_;
+
+  if (dedicated_threads_) {
+    network_thread_ = rtc::Thread::CreateWithSocketServer();
+    network_thread_->SetName("peerapi_network_thread", nullptr);
+    worker_thread_ = rtc::Thread::Create();
+    worker_thread_->SetName("peerapi_worker_thread", nullptr);
+
+    if (!network_thread_->Start() || !worker_thread_->Start()) {
+      LOG_F( LERROR ) << "Failed to start network and worker threads";
+      return false;
+    }
+
+    network_thread = network_thread_.get();
+    worker_thread = worker_thread_.get();
+  }
+
+  peer_connection_factory_ = webrtc::CreatePeerConnectionFactory(
+    network_thread, worker_thread, signaling_thread_,
+    fake_audio_capture_module_, nullptr, nullptr, nullptr, nullptr, NULL, NULL);
+
+  if (!peer_connection_factory_.get()) {
+    LOG_F( LERROR ) << "Failed to create CreatePeerConnectionFactory";
+    return false;
+  }
+
+  LOG_F( INFO ) << "Done";
+  return true;
+}
+
+} // namespace peerapi
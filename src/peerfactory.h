@@ -0,0 +1,63 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#ifndef __PEERAPI_PEERFACTORY_H__
+#define __PEERAPI_PEERFACTORY_H__
+
+#include <memory>
+
+#include "api/peer_connection_interface.h"
+#include "api/scoped_refptr.h"
+#include "rtc_base/thread.h"
+#include "fakeaudiocapturemodule.h"
+
+
+namespace peerapi {
+
+//
+// class PeerFactory
+//
+// Owns a PeerConnectionFactory and everything it runs on: the audio device
+// module and, in dedicated threading mode, network and worker threads.
+// A shared PeerFactory is reused by every Control opened on the same
+// signaling thread with the same options, so many Peer instances in one
+// process pay for factory startup once.
+//
+
+class PeerFactory {
+public:
+
+  ~PeerFactory();
+
+  // Creates a new factory bound to the current thread, or returns the one
+  // already shared on this thread if |shared| is true.
+  static std::shared_ptr<PeerFactory> Create(bool dedicated_threads, bool shared);
+
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
+      peer_connection_factory() const { return peer_connection_factory_; }
+  rtc::Thread* signaling_thread() const { return signaling_thread_; }
+
+private:
+
+  explicit PeerFactory(bool dedicated_threads);
+  bool Initialize();
+
+  bool dedicated_threads_;
+  rtc::Thread* signaling_thread_;
+
+  // Network and worker threads of WebRTC if dedicated_threads_ is set.
+  // Otherwise WebRTC runs entirely on signaling_thread_.
+  std::unique_ptr<rtc::Thread> network_thread_;
+  std::unique_ptr<rtc::Thread> worker_thread_;
+
+  rtc::scoped_refptr<FakeAudioCaptureModule> fake_audio_capture_module_;
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
+      peer_connection_factory_;
+};
+
+} // namespace peerapi
+
+#endif // __PEERAPI_PEERFACTORY_H__
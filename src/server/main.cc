@@ -0,0 +1,113 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+//
+// peerapi_signal_server
+//
+// A standalone signal server for peers with the "url" option pointing to it.
+// Runs until SIGINT or SIGTERM.
+//
+// Usage: peerapi_signal_server certificate.pem [--port 443] [--address 0.0.0.0]
+//                              [--threads N]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "server/signalserver.h"
+
+using namespace std;
+
+
+namespace {
+
+std::atomic<bool> stop_requested(false);
+
+void OnSignal(int) {
+  stop_requested = true;
+}
+
+} // namespace
+
+void usage(const char* prg);
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  string certificate = argv[1];
+  string address = "0.0.0.0";
+  uint16_t port = 443;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 2; i < argc; i += 2) {
+    string arg = argv[i];
+    if (i + 1 == argc) {
+      std::cerr << "Missing a value of " << arg << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+    string value = argv[i + 1];
+
+    unsigned long number = 0;
+    if (arg == "--port" || arg == "--threads") {
+      try {
+        number = stoul(value);
+      }
+      catch (const std::exception&) {
+        number = 0;
+      }
+      if (number == 0 || (arg == "--port" && number > 65535)) {
+        std::cerr << "Invalid " << arg << ": " << value << std::endl;
+        usage(argv[0]);
+        return 1;
+      }
+    }
+
+    if (arg == "--port") port = static_cast<uint16_t>(number);
+    else if (arg == "--address") address = value;
+    else if (arg == "--threads") threads = number;
+    else {
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  peerapi::SignalServer server;
+  if (!server.Start(port, certificate, threads, address)) {
+    std::cerr << "Failed to start signal server" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Listening on " << address << ":" << server.port()
+            << " with " << threads << " threads" << std::endl;
+
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+
+  while (!stop_requested) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+
+  server.Stop();
+  return 0;
+}
+
+void usage(const char* prg) {
+  std::cerr << std::endl;
+  std::cerr << "Usage: " << prg << " certificate.pem [--port 443] [--address 0.0.0.0] [--threads N]"
+            << std::endl << std::endl;
+  std::cerr << "Example: " << std::endl << std::endl;
+  std::cerr << "   > " << prg << " server.pem --port 8443 --threads 4" << std::endl;
+}
@@ -0,0 +1,382 @@
+/*
+ *  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+ *
+ *  Ryan Lee
+ */
+
+#include <chrono>
+#include <functional>
+
+#include "signalserver.h"
+
+#include "rtc_base/helpers.h"
+#include "logging.h"
+
+namespace peerapi {
+
+namespace {
+
+// Stop() waits this long for clients to finish the closing handshake
+const auto kCloseTimeout = std::chrono::seconds(2);
+
+// A connection sends only 'open' before it has a session, which holds a
+// user id and password
+const size_t kMaxOpenMessageSize = 4 * 1024;
+
+} // namespace
+
+
+SignalServer::SignalServer()
+    : session_count_(0),
+      port_(0) {
+
+  server_.clear_access_channels(websocketpp::log::alevel::all);
+  server_.clear_error_channels(websocketpp::log::elevel::all);
+
+  server_.init_asio();
+  server_.set_reuse_addr(true);
+  server_.set_max_message_size(SIGNAL_MAX_MESSAGE_SIZE);
+  server_.set_listen_backlog(asio::socket_base::max_connections);
+
+  using websocketpp::lib::placeholders::_1;
+  using websocketpp::lib::placeholders::_2;
+  using websocketpp::lib::bind;
+
+  server_.set_validate_handler(bind(&SignalServer::OnValidate, this, _1));
+  server_.set_open_handler(bind(&SignalServer::OnOpen, this, _1));
+  server_.set_close_handler(bind(&SignalServer::OnClose, this, _1));
+  server_.set_message_handler(bind(&SignalServer::OnMessage, this, _1, _2));
+  server_.set_socket_init_handler(bind(&SignalServer::OnSocketInit, this, _1, _2));
+  server_.set_tls_init_handler(bind(&SignalServer::OnTlsInit, this, _1));
+}
+
+SignalServer::~SignalServer() {
+  Stop();
+}
+
+bool SignalServer::Start(uint16_t port, const string& certificate, size_t threads,
+                         const string& address) {
+  if (!threads_.empty()) {
+    LOG_F( WARNING ) << "Already started";
+    return false;
+  }
+
+  //
+  // Every connection shares one TLS context, so the certificate is loaded
+  // once instead of for each session.
+  //
+
+  asio::error_code ec;
+  tls_context_.reset(new asio::ssl::context(asio::ssl::context::sslv23));
+  tls_context_->set_options(asio::ssl::context::default_workarounds |
+                            asio::ssl::context::no_sslv2 |
+                            asio::ssl::context::no_sslv3, ec);
+  tls_context_->use_certificate_chain_file(certificate, ec);
+  if (!ec) {
+    tls_context_->use_private_key_file(certificate, asio::ssl::context::pem, ec);
+  }
+
+  if (ec) {
+    LOG_F( LERROR ) << "Init tls failed, reason: " << ec.message();
+    return false;
+  }
+
+  asio::ip::address listen_address = asio::ip::address::from_string(address, ec);
+  if (ec) {
+    LOG_F( LERROR ) << "Invalid address: " << address;
+    return false;
+  }
+
+  websocketpp::lib::error_code listen_ec;
+  server_.listen(asio::ip::tcp::endpoint(listen_address, port), listen_ec);
+  if (!listen_ec) {
+    server_.start_accept(listen_ec);
+  }
+
+  if (listen_ec) {
+    LOG_F( LERROR ) << "Failed to listen: " << listen_ec.message();
+    return false;
+  }
+
+  port_ = server_.get_local_endpoint(ec).port();
+
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+    threads_.emplace_back([this]() { server_.run(); });
+  }
+
+  LOG_F( INFO ) << "Done, port is " << port_ << " and threads are " << threads_.size();
+  return true;
+}
+
+void SignalServer::Stop() {
+  if (threads_.empty()) return;
+
+  server_.get_io_service().post(websocketpp::lib::bind(&SignalServer::CloseAll, this));
+
+  auto deadline = std::chrono::steady_clock::now() + kCloseTimeout;
+  while (session_count_ > 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // Drop sessions that did not close in time
+  server_.stop();
+
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+
+  LOG_F( INFO ) << "Done";
+}
+
+SignalServer::string SignalServer::local_url() const {
+  return "wss://127.0.0.1:" + std::to_string(port_) + "/";
+}
+
+void SignalServer::CloseAll() {
+  websocketpp::lib::error_code ec;
+  server_.stop_listening(ec);
+
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.lock_);
+    for (auto& channel : shard.channels_) {
+      server_.close(channel.second, websocketpp::close::status::going_away, "Server stopped", ec);
+    }
+  }
+}
+
+
+//
+// websocket callbacks
+//
+
+bool SignalServer::OnValidate(connection_hdl con) {
+  websocketpp::lib::error_code ec;
+  server_type::connection_ptr connection = server_.get_con_from_hdl(con, ec);
+  if (ec) return false;
+
+  for (const auto& protocol : connection->get_requested_subprotocols()) {
+    if (protocol == SIGNAL_BINARY_PROTOCOL) {
+      connection->select_subprotocol(protocol, ec);
+      connection->binary_ = !ec;
+      break;
+    }
+  }
+
+  return true;
+}
+
+void SignalServer::OnOpen(connection_hdl con) {
+  ++session_count_;
+}
+
+void SignalServer::OnClose(connection_hdl con) {
+  --session_count_;
+
+  websocketpp::lib::error_code ec;
+  server_type::connection_ptr connection = server_.get_con_from_hdl(con, ec);
+  if (ec) return;
+
+  if (!connection->name_.empty()) {
+    RemoveChannel(connection->name_, con);
+  }
+}
+
+void SignalServer::OnMessage(connection_hdl con, server_type::message_ptr msg) {
+  websocketpp::lib::error_code ec;
+  server_type::connection_ptr connection = server_.get_con_from_hdl(con, ec);
+  if (ec) return;
+
+  Session& session = *connection;
+  const string& payload = msg->get_payload();
+  SignalCommand command;
+
+  if (session.session_id_.empty() && payload.size() > kMaxOpenMessageSize) {
+    LOG_F( WARNING ) << "Message of " << payload.size() << " bytes before 'open'";
+    return;
+  }
+
+  bool decoded = msg->get_opcode() == websocketpp::frame::opcode::binary
+                     ? DecodeSignalCommandBinary(payload.data(), payload.size(), &command)
+                     : DecodeSignalCommand(payload.data(), payload.size(), &command);
+
+  if (!decoded) {
+    LOG_F( WARNING ) << "Invalid message of " << payload.size() << " bytes";
+    return;
+  }
+
+  switch (command.type_) {
+  case SIGNAL_OPEN:
+    OpenSession(con, session);
+    break;
+  case SIGNAL_CREATE_CHANNEL:
+    CreateChannel(con, session, command.channel_);
+    break;
+  case SIGNAL_JOIN_CHANNEL:
+    JoinChannel(con, session, command.channel_);
+    break;
+  case SIGNAL_LEAVE_CHANNEL:
+    LeaveChannel(session, command.channel_);
+    break;
+  case SIGNAL_OFFER_SDP:
+  case SIGNAL_ANSWER_SDP:
+  case SIGNAL_ICE_CANDIDATE:
+    Forward(session, command);
+    break;
+  default:
+    LOG_F( WARNING ) << "Unknown command: " << SignalCommandName(command.type_);
+    break;
+  }
+}
+
+void SignalServer::OnSocketInit(connection_hdl con, asio::ssl::stream<asio::ip::tcp::socket>& socket) {
+  // Signaling messages are small and latency bound
+  asio::error_code ec;
+  socket.lowest_layer().set_option(asio::ip::tcp::no_delay(true), ec);
+}
+
+SignalServer::context_ptr SignalServer::OnTlsInit(connection_hdl con) {
+  return tls_context_;
+}
+
+
+//
+// Commands
+//
+
+void SignalServer::OpenSession(connection_hdl con, Session& session) {
+  if (session.session_id_.empty()) {
+    session.session_id_ = rtc::CreateRandomUuid();
+  }
+
+  SignalCommand reply(SIGNAL_OPEN);
+  reply.result_ = true;
+  reply.session_id_ = session.session_id_;
+  SendCommand(con, reply);
+}
+
+void SignalServer::CreateChannel(connection_hdl con, Session& session, const string& name) {
+  SignalCommand reply(SIGNAL_CHANNEL_CREATE);
+  reply.name_ = name;
+
+  if (name.empty() || !session.name_.empty() || !AddChannel(name, con)) {
+    reply.result_ = false;
+    reply.desc_ = name.empty() ? "Invalid channel name" : "Channel already exists";
+    SendCommand(con, reply);
+    return;
+  }
+
+  session.name_ = name;
+
+  reply.result_ = true;
+  SendCommand(con, reply);
+}
+
+//
+// A peer joining a channel asks the owner of the channel to create
+// an offer to the joining peer.
+//
+
+void SignalServer::JoinChannel(connection_hdl con, Session& session, const string& name) {
+  SignalCommand reply(SIGNAL_CHANNEL_JOIN);
+  reply.name_ = name;
+
+  connection_hdl owner;
+  if (session.name_.empty() || session.name_ == name || !FindChannel(name, &owner)) {
+    reply.result_ = false;
+    reply.desc_ = "Channel not found";
+    SendCommand(con, reply);
+    return;
+  }
+
+  reply.result_ = true;
+  SendCommand(con, reply);
+
+  SignalCommand offer(SIGNAL_CREATE_OFFER);
+  offer.peers_.push_back(session.name_);
+  SendCommand(owner, offer);
+}
+
+void SignalServer::LeaveChannel(Session& session, const string& name) {
+  connection_hdl owner;
+  if (!FindChannel(name, &owner)) return;
+
+  SignalCommand closed(SIGNAL_PEER_CLOSED);
+  closed.name_ = name;
+  closed.peer_id_ = session.name_;
+  SendCommand(owner, closed);
+}
+
+void SignalServer::Forward(Session& session, SignalCommand& command) {
+  connection_hdl owner;
+  if (!FindChannel(command.channel_, &owner)) {
+    LOG_F( WARNING ) << "Channel not found: " << command.channel_;
+    return;
+  }
+
+  command.channel_.clear();
+  command.peer_id_ = session.name_;
+  SendCommand(owner, command);
+}
+
+
+//
+// Channel table
+//
+
+SignalServer::ChannelShard& SignalServer::Shard(const string& name) {
+  return shards_[std::hash<string>()(name) % kChannelShards];
+}
+
+bool SignalServer::AddChannel(const string& name, connection_hdl con) {
+  ChannelShard& shard = Shard(name);
+  std::lock_guard<std::mutex> lock(shard.lock_);
+  return shard.channels_.emplace(name, con).second;
+}
+
+void SignalServer::RemoveChannel(const string& name, connection_hdl con) {
+  ChannelShard& shard = Shard(name);
+  std::lock_guard<std::mutex> lock(shard.lock_);
+
+  auto found = shard.channels_.find(name);
+  if (found == shard.channels_.end()) return;
+
+  // Only the owner removes a channel
+  std::owner_less<connection_hdl> less;
+  if (!less(found->second, con) && !less(con, found->second)) {
+    shard.channels_.erase(found);
+  }
+}
+
+bool SignalServer::FindChannel(const string& name, connection_hdl* con) {
+  ChannelShard& shard = Shard(name);
+  std::lock_guard<std::mutex> lock(shard.lock_);
+
+  auto found = shard.channels_.find(name);
+  if (found == shard.channels_.end()) return false;
+
+  *con = found->second;
+  return true;
+}
+
+void SignalServer::SendCommand(connection_hdl con, const SignalCommand& command) {
+  websocketpp::lib::error_code ec;
+  server_type::connection_ptr connection = server_.get_con_from_hdl(con, ec);
+  if (ec) return;
+
+  string message;
+  if (connection->binary_) {
+    EncodeSignalCommandBinary(command, &message);
+    ec = connection->send(message, websocketpp::frame::opcode::binary);
+  }
+  else {
+    EncodeSignalCommand(command, &message);
+    ec = connection->send(message, websocketpp::frame::opcode::text);
+  }
+
+  if (ec) {
+    LOG_F( WARNING ) << "Failed to send " << SignalCommandName(command.type_) << ": " << ec.message();
+  }
+}
+
+} // namespace peerapi
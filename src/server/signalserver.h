@@ -0,0 +1,138 @@
+/*
+ *  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+ *
+ *  Ryan Lee
+ */
+
+#ifndef __PEERAPI_SIGNALSERVER_H__
+#define __PEERAPI_SIGNALSERVER_H__
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <websocketpp/config/asio.hpp>
+#include <websocketpp/server.hpp>
+
+#if defined(PEERAPI_SIGNAL_DEFLATE)
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#endif
+
+#include "signalcommand.h"
+
+namespace peerapi {
+
+//
+// class SignalServer
+//
+// A signal server speaking the protocol of class Signal and class Control.
+// Every session creates a channel named by its peer id. A command sent to
+// a channel is forwarded to the session owning it, with the name of the
+// sender in "peer_id".
+//
+// The io_service runs on a pool of threads. Handlers of one connection are
+// serialized by websocketpp, so a session keeps its state in the connection
+// itself and only the channel table is shared, split into shards each with
+// a lock of its own.
+//
+// A client offering the SIGNAL_BINARY_PROTOCOL subprotocol is sent binary
+// commands, and other clients JSON. A forwarded command is decoded and
+// encoded again, so clients of either encoding talk to each other.
+//
+// permessage-deflate is used with clients offering it if the server is
+// built with zlib.
+//
+
+class SignalServer {
+public:
+
+  using string = std::string;
+
+  // State of a session, stored in its websocket connection
+  struct Session {
+    string session_id_;
+    string name_;
+    bool binary_ = false;
+  };
+
+  struct server_config : public websocketpp::config::asio_tls {
+    typedef server_config type;
+    typedef websocketpp::config::asio_tls base;
+    typedef Session connection_base;
+
+#if defined(PEERAPI_SIGNAL_DEFLATE)
+    typedef websocketpp::extensions::permessage_deflate::enabled<base::permessage_deflate_config>
+        permessage_deflate_type;
+#endif
+  };
+
+  typedef websocketpp::server<server_config> server_type;
+
+  SignalServer();
+  ~SignalServer();
+
+  // Listens on |port| of |address|, or on a free port if |port| is 0.
+  // |certificate| is a PEM file holding the certificate chain followed by
+  // its private key.
+  bool Start(uint16_t port, const string& certificate, size_t threads = 1,
+             const string& address = "127.0.0.1");
+  void Stop();
+
+  uint16_t port() const { return port_; }
+  size_t session_count() const { return session_count_; }
+  string local_url() const;
+
+private:
+
+  typedef websocketpp::connection_hdl connection_hdl;
+  typedef websocketpp::lib::shared_ptr<asio::ssl::context> context_ptr;
+
+  struct ChannelShard {
+    std::mutex lock_;
+    std::unordered_map<string, connection_hdl> channels_;
+  };
+
+  static const size_t kChannelShards = 64;
+
+  // websocket callbacks
+  bool OnValidate(connection_hdl con);
+  void OnOpen(connection_hdl con);
+  void OnClose(connection_hdl con);
+  void OnMessage(connection_hdl con, server_type::message_ptr msg);
+  void OnSocketInit(connection_hdl con, asio::ssl::stream<asio::ip::tcp::socket>& socket);
+  context_ptr OnTlsInit(connection_hdl con);
+
+  // Commands from clients
+  void OpenSession(connection_hdl con, Session& session);
+  void CreateChannel(connection_hdl con, Session& session, const string& name);
+  void JoinChannel(connection_hdl con, Session& session, const string& name);
+  void LeaveChannel(Session& session, const string& name);
+  void Forward(Session& session, SignalCommand& command);
+
+  // Channel table
+  ChannelShard& Shard(const string& name);
+  bool AddChannel(const string& name, connection_hdl con);
+  void RemoveChannel(const string& name, connection_hdl con);
+  bool FindChannel(const string& name, connection_hdl* con);
+
+  void SendCommand(connection_hdl con, const SignalCommand& command);
+  void CloseAll();
+
+  server_type server_;
+  std::vector<std::thread> threads_;
+
+  std::array<ChannelShard, kChannelShards> shards_;
+  std::atomic<size_t> session_count_;
+
+  context_ptr tls_context_;
+  uint16_t port_;
+};
+
+} // namespace peerapi
+
+#endif // __PEERAPI_SIGNALSERVER_H__
@@ -0,0 +1,1020 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "signalcommand.h"
+
+namespace peerapi {
+
+namespace {
+
+struct CommandName {
+  SignalCommandType type_;
+  const char* name_;
+};
+
+const CommandName kCommandNames[] = {
+  { SIGNAL_OPEN,            "open" },
+  { SIGNAL_CREATE_CHANNEL,  "createchannel" },
+  { SIGNAL_JOIN_CHANNEL,    "joinchannel" },
+  { SIGNAL_LEAVE_CHANNEL,   "leavechannel" },
+  { SIGNAL_CHANNEL_CREATE,  "channelcreate" },
+  { SIGNAL_CHANNEL_JOIN,    "channeljoin" },
+  { SIGNAL_CHANNEL_LEAVE,   "channelleave" },
+  { SIGNAL_PEER_CLOSED,     "peerclosed" },
+  { SIGNAL_CREATE_OFFER,    "createoffer" },
+  { SIGNAL_OFFER_SDP,       "offersdp" },
+  { SIGNAL_ANSWER_SDP,      "answersdp" },
+  { SIGNAL_ICE_CANDIDATE,   "ice_candidate" }
+};
+
+// Arrays and objects nested deeper are refused in skipped members
+const int kMaxSkipDepth = 32;
+
+template <std::size_t N>
+bool IsName(const char* key, std::size_t length, const char (&name)[N]) {
+  return length == N - 1 && std::memcmp(key, name, N - 1) == 0;
+}
+
+//
+// class JsonReader
+//
+// Reads JSON text in place. Keys and the command name are compared where
+// they are in the text, so only string values being kept are copied.
+//
+
+class JsonReader {
+public:
+  JsonReader(const char* data, std::size_t size) : p_(data), end_(data + size) {}
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (p_ == end_ || *p_ != c) return false;
+    ++p_;
+    return true;
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return p_ == end_;
+  }
+
+  // Calls |member| with the raw key of each member, which reads the value
+  template <typename F>
+  bool ReadObject(F member) {
+    if (!Consume('{')) return false;
+    if (Consume('}')) return true;
+
+    do {
+      const char* key;
+      std::size_t length;
+      if (!ScanString(&key, &length) || !Consume(':') || !member(key, length)) return false;
+    } while (Consume(','));
+
+    return Consume('}');
+  }
+
+  // Calls |element| for each element, which reads it
+  template <typename F>
+  bool ReadArray(F element) {
+    if (!Consume('[')) return false;
+    if (Consume(']')) return true;
+
+    do {
+      if (!element()) return false;
+    } while (Consume(','));
+
+    return Consume(']');
+  }
+
+  // Finds the end of a string without decoding its escapes
+  bool ScanString(const char** begin, std::size_t* length) {
+    if (!Consume('"')) return false;
+
+    const char* start = p_;
+    while (p_ < end_) {
+      const char c = *p_;
+      if (c == '"') {
+        *begin = start;
+        *length = p_ - start;
+        ++p_;
+        return true;
+      }
+      if (c == '\\') {
+        if (++p_ == end_) return false;
+      }
+      else if (static_cast<unsigned char>(c) < 0x20) {
+        return false;
+      }
+      ++p_;
+    }
+    return false;
+  }
+
+  bool ReadString(std::string* out) {
+    if (!Consume('"')) return false;
+
+    out->clear();
+    const char* run = p_;
+
+    while (p_ < end_) {
+      const char c = *p_;
+
+      if (c == '"') {
+        out->append(run, p_ - run);
+        ++p_;
+        return true;
+      }
+
+      if (c == '\\') {
+        out->append(run, p_ - run);
+        if (++p_ == end_) return false;
+
+        switch (*p_++) {
+        case '"':  out->push_back('"'); break;
+        case '\\': out->push_back('\\'); break;
+        case '/':  out->push_back('/'); break;
+        case 'b':  out->push_back('\b'); break;
+        case 'f':  out->push_back('\f'); break;
+        case 'n':  out->push_back('\n'); break;
+        case 'r':  out->push_back('\r'); break;
+        case 't':  out->push_back('\t'); break;
+        case 'u':
+          if (!ReadCodePoint(out)) return false;
+          break;
+        default:
+          return false;
+        }
+
+        run = p_;
+        continue;
+      }
+
+      if (static_cast<unsigned char>(c) < 0x20) return false;
+      ++p_;
+    }
+
+    return false;
+  }
+
+  bool ReadBool(bool* out) {
+    SkipSpace();
+    if (Literal("true")) { *out = true; return true; }
+    if (Literal("false")) { *out = false; return true; }
+    return false;
+  }
+
+  // Finds the end of a number without converting it
+  bool ScanNumber(const char** begin, std::size_t* length) {
+    SkipSpace();
+
+    const char* start = p_;
+    while (p_ < end_ && *p_ != '\0' && std::strchr("+-.eE0123456789", *p_) != nullptr) {
+      ++p_;
+    }
+
+    *begin = start;
+    *length = p_ - start;
+    return p_ != start;
+  }
+
+  // The first character of the next value, or '\0' at the end
+  char Peek() {
+    SkipSpace();
+    return p_ == end_ ? '\0' : *p_;
+  }
+
+  bool Skip(int depth = 0) {
+    if (depth > kMaxSkipDepth) return false;
+
+    SkipSpace();
+    if (p_ == end_) return false;
+
+    switch (*p_) {
+    case '"': {
+      const char* begin;
+      std::size_t length;
+      return ScanString(&begin, &length);
+    }
+    case '{':
+      return ReadObject([this, depth](const char*, std::size_t) { return Skip(depth + 1); });
+    case '[':
+      return ReadArray([this, depth]() { return Skip(depth + 1); });
+    case 't':
+      return Literal("true");
+    case 'f':
+      return Literal("false");
+    case 'n':
+      return Literal("null");
+    default: {
+      const char* begin;
+      std::size_t length;
+      return ScanNumber(&begin, &length);
+    }
+    }
+  }
+
+private:
+  void SkipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) ++p_;
+  }
+
+  template <std::size_t N>
+  bool Literal(const char (&literal)[N]) {
+    if (static_cast<std::size_t>(end_ - p_) < N - 1 || std::memcmp(p_, literal, N - 1) != 0) {
+      return false;
+    }
+    p_ += N - 1;
+    return true;
+  }
+
+  bool ReadHex(unsigned* out) {
+    if (end_ - p_ < 4) return false;
+
+    unsigned value = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char c = *p_++;
+      value <<= 4;
+      if (c >= '0' && c <= '9') value |= c - '0';
+      else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+      else return false;
+    }
+
+    *out = value;
+    return true;
+  }
+
+  // Reads the digits of \uXXXX, and a low surrogate following a high one,
+  // and appends the code point as UTF-8
+  bool ReadCodePoint(std::string* out) {
+    unsigned code;
+    if (!ReadHex(&code)) return false;
+
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      unsigned low;
+      if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') return false;
+      p_ += 2;
+      if (!ReadHex(&low) || low < 0xDC00 || low > 0xDFFF) return false;
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    else if (code >= 0xDC00 && code <= 0xDFFF) {
+      return false;
+    }
+
+    if (code < 0x80) {
+      out->push_back(static_cast<char>(code));
+    }
+    else if (code < 0x800) {
+      out->push_back(static_cast<char>(0xC0 | (code >> 6)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else if (code < 0x10000) {
+      out->push_back(static_cast<char>(0xE0 | (code >> 12)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else {
+      out->push_back(static_cast<char>(0xF0 | (code >> 18)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    return true;
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+//
+// A known member of another type is read the way rtc::Get*FromJsonObject()
+// read it: a number or a bool as a string, "true", "false" or a number as a
+// bool, and a whole number in any form as an int. Any other value, null
+// included, is skipped and leaves the field as it was.
+//
+
+bool ParseInt(const std::string& text, int* out) {
+  if (text.empty()) return false;
+
+  char* end;
+  const double value = std::strtod(text.c_str(), &end);
+  if (*end != '\0' || value != std::floor(value) ||
+      value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+    return false;
+  }
+
+  *out = static_cast<int>(value);
+  return true;
+}
+
+bool ReadStringValue(JsonReader& reader, std::string* out) {
+  const char c = reader.Peek();
+
+  if (c == '"') return reader.ReadString(out);
+
+  if (c == 't' || c == 'f') {
+    bool value;
+    if (!reader.ReadBool(&value)) return false;
+    *out = value ? "true" : "false";
+    return true;
+  }
+
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    const char* begin;
+    std::size_t length;
+    if (!reader.ScanNumber(&begin, &length)) return false;
+    out->assign(begin, length);
+    return true;
+  }
+
+  return reader.Skip();
+}
+
+bool ReadBoolValue(JsonReader& reader, bool* out) {
+  const char c = reader.Peek();
+
+  if (c == 't' || c == 'f') return reader.ReadBool(out);
+
+  if (c == '"') {
+    std::string text;
+    if (!reader.ReadString(&text)) return false;
+    if (text == "true") *out = true;
+    else if (text == "false") *out = false;
+    return true;
+  }
+
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    const char* begin;
+    std::size_t length;
+    if (!reader.ScanNumber(&begin, &length)) return false;
+    *out = std::strtod(std::string(begin, length).c_str(), nullptr) != 0;
+    return true;
+  }
+
+  return reader.Skip();
+}
+
+bool ReadIntValue(JsonReader& reader, int* out) {
+  const char c = reader.Peek();
+  std::string text;
+
+  if (c == '"') {
+    if (!reader.ReadString(&text)) return false;
+  }
+  else if (c == '-' || (c >= '0' && c <= '9')) {
+    const char* begin;
+    std::size_t length;
+    if (!reader.ScanNumber(&begin, &length)) return false;
+    text.assign(begin, length);
+  }
+  else {
+    return reader.Skip();
+  }
+
+  int value;
+  if (ParseInt(text, &value)) *out = value;
+  return true;
+}
+
+bool ReadCandidateMember(JsonReader& reader, const char* key, std::size_t length,
+                         IceCandidateData* candidate, bool* found) {
+  if (IsName(key, length, "sdp_mid")) {
+    *found = true;
+    return ReadStringValue(reader, &candidate->sdp_mid_);
+  }
+  if (IsName(key, length, "sdp_mline_index")) {
+    *found = true;
+    return ReadIntValue(reader, &candidate->sdp_mline_index_);
+  }
+  if (IsName(key, length, "candidate")) {
+    *found = true;
+    return ReadStringValue(reader, &candidate->candidate_);
+  }
+  return reader.Skip();
+}
+
+bool ReadData(JsonReader& reader, SignalCommand* command) {
+  IceCandidateData single;
+  bool has_single = false;
+  bool has_candidates = false;
+
+  if (reader.Peek() != '{') return reader.Skip();
+
+  bool read = reader.ReadObject([&](const char* key, std::size_t length) {
+    if (IsName(key, length, "result")) return ReadBoolValue(reader, &command->result_);
+    if (IsName(key, length, "user_id")) return ReadStringValue(reader, &command->user_id_);
+    if (IsName(key, length, "user_password")) return ReadStringValue(reader, &command->user_password_);
+    if (IsName(key, length, "session_id")) return ReadStringValue(reader, &command->session_id_);
+    if (IsName(key, length, "name")) return ReadStringValue(reader, &command->name_);
+    if (IsName(key, length, "desc")) return ReadStringValue(reader, &command->desc_);
+    if (IsName(key, length, "sdp")) return ReadStringValue(reader, &command->sdp_);
+
+    if (IsName(key, length, "peers")) {
+      if (reader.Peek() != '[') return reader.Skip();
+
+      return reader.ReadArray([&]() {
+        std::string peer;
+        if (!ReadStringValue(reader, &peer)) return false;
+        if (!peer.empty()) command->peers_.push_back(std::move(peer));
+        return true;
+      });
+    }
+
+    if (IsName(key, length, "candidates")) {
+      if (reader.Peek() != '[') return reader.Skip();
+
+      has_candidates = true;
+      return reader.ReadArray([&]() {
+        if (reader.Peek() != '{') return reader.Skip();
+
+        command->candidates_.emplace_back();
+        bool found = false;
+        return reader.ReadObject([&](const char* member, std::size_t member_length) {
+          return ReadCandidateMember(reader, member, member_length, &command->candidates_.back(), &found);
+        });
+      });
+    }
+
+    return ReadCandidateMember(reader, key, length, &single, &has_single);
+  });
+
+  // A batch of candidates takes the place of a single one
+  if (read && has_single && !has_candidates) {
+    command->candidates_.push_back(std::move(single));
+  }
+
+  return read;
+}
+
+void AppendString(std::string* out, const std::string& value) {
+  static const char kHex[] = "0123456789abcdef";
+
+  out->push_back('"');
+
+  std::size_t run = 0;
+  for (std::size_t i = 0; i < value.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    out->append(value, run, i - run);
+    run = i + 1;
+
+    switch (c) {
+    case '"':  out->append("\\\""); break;
+    case '\\': out->append("\\\\"); break;
+    case '\n': out->append("\\n"); break;
+    case '\r': out->append("\\r"); break;
+    case '\t': out->append("\\t"); break;
+    default:
+      out->append("\\u00");
+      out->push_back(kHex[c >> 4]);
+      out->push_back(kHex[c & 0xF]);
+      break;
+    }
+  }
+
+  out->append(value, run, std::string::npos);
+  out->push_back('"');
+}
+
+void AppendMember(std::string* out, const char* key, const std::string& value, bool* first) {
+  if (!*first) out->push_back(',');
+  *first = false;
+
+  out->push_back('"');
+  out->append(key);
+  out->append("\":");
+  AppendString(out, value);
+}
+
+void AppendCandidate(std::string* out, const IceCandidateData& candidate) {
+  char index[16];
+  std::snprintf(index, sizeof(index), "%d", candidate.sdp_mline_index_);
+
+  bool first = true;
+  AppendMember(out, "candidate", candidate.candidate_, &first);
+  AppendMember(out, "sdp_mid", candidate.sdp_mid_, &first);
+  out->append(",\"sdp_mline_index\":");
+  out->append(index);
+}
+
+//
+// Binary encoding
+//
+
+enum CommandTag {
+  TAG_CHANNEL = 1,
+  TAG_PEER_ID,
+  TAG_RESULT,
+  TAG_USER_ID,
+  TAG_USER_PASSWORD,
+  TAG_SESSION_ID,
+  TAG_NAME,
+  TAG_DESC,
+  TAG_SDP,
+  TAG_CANDIDATE,
+  TAG_PEER
+};
+
+enum CandidateTag {
+  TAG_SDP_MID = 1,
+  TAG_SDP_MLINE_INDEX,
+  TAG_CANDIDATE_LINE
+};
+
+struct DictionaryEntry {
+  const char* text_;
+  std::size_t length_;
+};
+
+template <std::size_t N>
+constexpr DictionaryEntry Entry(const char (&text)[N]) {
+  return { text, N - 1 };
+}
+
+//
+// A packed line is one token byte:
+//
+//   0             a literal line, with a varint length and the line
+//   1 to 127      kSdpLines[token - 1]
+//   128 to 255    kSdpPrefixes[token - 128], with a varint length and
+//                 the rest of the line
+//
+// Lines are separated by CRLF, so the empty line after the last CRLF of SDP
+// is written too.
+//
+
+const unsigned char kLiteralLine = 0;
+const unsigned char kFirstPrefix = 0x80;
+
+const DictionaryEntry kSdpLines[] = {
+  Entry(""),
+  Entry("v=0"),
+  Entry("s=-"),
+  Entry("t=0 0"),
+  Entry("a=group:BUNDLE data"),
+  Entry("a=group:BUNDLE 0"),
+  Entry("a=msid-semantic: WMS"),
+  Entry("m=application 9 DTLS/SCTP 5000"),
+  Entry("m=application 9 UDP/DTLS/SCTP webrtc-datachannel"),
+  Entry("c=IN IP4 0.0.0.0"),
+  Entry("a=ice-options:trickle"),
+  Entry("a=ice-options:trickle renomination"),
+  Entry("a=setup:actpass"),
+  Entry("a=setup:active"),
+  Entry("a=setup:passive"),
+  Entry("a=mid:data"),
+  Entry("a=mid:0"),
+  Entry("a=sctpmap:5000 webrtc-datachannel 1024"),
+  Entry("a=sctp-port:5000"),
+  Entry("a=max-message-size:262144"),
+  Entry("a=extmap-allow-mixed"),
+  Entry("a=end-of-candidates")
+};
+
+const DictionaryEntry kSdpPrefixes[] = {
+  Entry("o=- "),
+  Entry("a=ice-ufrag:"),
+  Entry("a=ice-pwd:"),
+  Entry("a=fingerprint:sha-256 "),
+  Entry("a=fingerprint:"),
+  Entry("a=candidate:"),
+  Entry("candidate:"),
+  Entry("a=group:BUNDLE "),
+  Entry("a=msid-semantic: "),
+  Entry("m=application "),
+  Entry("c=IN IP4 "),
+  Entry("c=IN IP6 "),
+  Entry("a=mid:"),
+  Entry("a=setup:"),
+  Entry("a=ice-options:"),
+  Entry("a=sctpmap:"),
+  Entry("a=sctp-port:"),
+  Entry("a=max-message-size:"),
+  Entry("a=")
+};
+
+static_assert(sizeof(kSdpLines) / sizeof(kSdpLines[0]) < kFirstPrefix, "Too many SDP lines");
+static_assert(sizeof(kSdpPrefixes) / sizeof(kSdpPrefixes[0]) <= 0x100 - kFirstPrefix, "Too many SDP prefixes");
+
+void AppendVarint(std::string* out, std::size_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void AppendField(std::string* out, unsigned char tag, const char* value, std::size_t length) {
+  out->push_back(static_cast<char>(tag));
+  AppendVarint(out, length);
+  out->append(value, length);
+}
+
+void AppendField(std::string* out, unsigned char tag, const std::string& value) {
+  if (value.empty()) return;
+  AppendField(out, tag, value.data(), value.size());
+}
+
+void PackLine(const char* line, std::size_t length, std::string* out) {
+  for (std::size_t i = 0; i < sizeof(kSdpLines) / sizeof(kSdpLines[0]); ++i) {
+    if (kSdpLines[i].length_ == length && std::memcmp(kSdpLines[i].text_, line, length) == 0) {
+      out->push_back(static_cast<char>(i + 1));
+      return;
+    }
+  }
+
+  // The longest prefix saves the most
+  std::size_t prefix = 0;
+  std::size_t prefix_length = 0;
+  for (std::size_t i = 0; i < sizeof(kSdpPrefixes) / sizeof(kSdpPrefixes[0]); ++i) {
+    const DictionaryEntry& entry = kSdpPrefixes[i];
+    if (entry.length_ > prefix_length && entry.length_ <= length &&
+        std::memcmp(entry.text_, line, entry.length_) == 0) {
+      prefix = i;
+      prefix_length = entry.length_;
+    }
+  }
+
+  if (prefix_length > 0) {
+    AppendField(out, static_cast<unsigned char>(kFirstPrefix + prefix),
+                line + prefix_length, length - prefix_length);
+  }
+  else {
+    AppendField(out, kLiteralLine, line, length);
+  }
+}
+
+void PackLines(const std::string& text, std::string* out) {
+  std::size_t begin = 0;
+  for (;;) {
+    const std::size_t end = text.find("\r\n", begin);
+    PackLine(text.data() + begin, (end == std::string::npos ? text.size() : end) - begin, out);
+    if (end == std::string::npos) break;
+    begin = end + 2;
+  }
+}
+
+void AppendPackedField(std::string* out, unsigned char tag, const std::string& text) {
+  if (text.empty()) return;
+
+  std::string packed;
+  packed.reserve(text.size());
+  PackLines(text, &packed);
+  AppendField(out, tag, packed);
+}
+
+class BinaryReader {
+public:
+  BinaryReader(const char* data, std::size_t size) : p_(data), end_(data + size) {}
+
+  bool AtEnd() const { return p_ == end_; }
+
+  bool ReadByte(unsigned char* out) {
+    if (p_ == end_) return false;
+    *out = static_cast<unsigned char>(*p_++);
+    return true;
+  }
+
+  // Five bytes hold any value of 32 bits
+  bool ReadVarint(uint32_t* out) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      unsigned char byte;
+      if (!ReadByte(&byte)) return false;
+      value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        *out = value;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadBytes(const char** begin, std::size_t* length) {
+    uint32_t size;
+    if (!ReadVarint(&size) || size > static_cast<std::size_t>(end_ - p_)) return false;
+    *begin = p_;
+    *length = size;
+    p_ += size;
+    return true;
+  }
+
+  bool ReadField(unsigned char* tag, const char** value, std::size_t* length) {
+    return ReadByte(tag) && ReadBytes(value, length);
+  }
+
+private:
+  const char* p_;
+  const char* end_;
+};
+
+// Fails if the lines take more than |*remaining| bytes, and takes their size
+// from it otherwise. A small field unpacks to many times its size, so the
+// limit is shared by all the fields of a command.
+bool UnpackLines(const char* data, std::size_t size, std::size_t* remaining, std::string* out) {
+  BinaryReader reader(data, size);
+
+  out->clear();
+  out->reserve(std::min(size * 2, *remaining));
+
+  for (bool first = true; !reader.AtEnd(); first = false) {
+    if (out->size() > *remaining) return false;
+    if (!first) out->append("\r\n");
+
+    unsigned char token;
+    reader.ReadByte(&token);
+
+    if (token != kLiteralLine && token < kFirstPrefix) {
+      const std::size_t index = token - 1;
+      if (index >= sizeof(kSdpLines) / sizeof(kSdpLines[0])) return false;
+      out->append(kSdpLines[index].text_, kSdpLines[index].length_);
+      continue;
+    }
+
+    if (token >= kFirstPrefix) {
+      const std::size_t index = token - kFirstPrefix;
+      if (index >= sizeof(kSdpPrefixes) / sizeof(kSdpPrefixes[0])) return false;
+      out->append(kSdpPrefixes[index].text_, kSdpPrefixes[index].length_);
+    }
+
+    const char* rest;
+    std::size_t length;
+    if (!reader.ReadBytes(&rest, &length)) return false;
+    out->append(rest, length);
+  }
+
+  if (out->size() > *remaining) return false;
+  *remaining -= out->size();
+  return true;
+}
+
+void AppendBinaryCandidate(std::string* out, const IceCandidateData& candidate) {
+  std::string field;
+  field.reserve(candidate.candidate_.size() + 16);
+
+  AppendField(&field, TAG_SDP_MID, candidate.sdp_mid_);
+
+  std::string index;
+  AppendVarint(&index, static_cast<uint32_t>(candidate.sdp_mline_index_));
+  AppendField(&field, TAG_SDP_MLINE_INDEX, index);
+
+  AppendPackedField(&field, TAG_CANDIDATE_LINE, candidate.candidate_);
+  AppendField(out, TAG_CANDIDATE, field.data(), field.size());
+}
+
+bool ReadBinaryCandidate(const char* data, std::size_t size, std::size_t* remaining,
+                         IceCandidateData* candidate) {
+  BinaryReader reader(data, size);
+
+  while (!reader.AtEnd()) {
+    unsigned char tag;
+    const char* value;
+    std::size_t length;
+    if (!reader.ReadField(&tag, &value, &length)) return false;
+
+    switch (tag) {
+    case TAG_SDP_MID:
+      candidate->sdp_mid_.assign(value, length);
+      break;
+    case TAG_SDP_MLINE_INDEX: {
+      BinaryReader index(value, length);
+      uint32_t mline_index;
+      if (!index.ReadVarint(&mline_index)) return false;
+      candidate->sdp_mline_index_ = static_cast<int>(mline_index);
+      break;
+    }
+    case TAG_CANDIDATE_LINE:
+      if (!UnpackLines(value, length, remaining, &candidate->candidate_)) return false;
+      break;
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+
+const char* SignalCommandName(SignalCommandType type) {
+  for (const auto& command : kCommandNames) {
+    if (command.type_ == type) return command.name_;
+  }
+  return "";
+}
+
+SignalCommandType ToSignalCommandType(const char* name, std::size_t length) {
+  for (const auto& command : kCommandNames) {
+    if (std::strlen(command.name_) == length && std::memcmp(command.name_, name, length) == 0) {
+      return command.type_;
+    }
+  }
+  return SIGNAL_UNKNOWN;
+}
+
+bool DecodeSignalCommand(const char* json, std::size_t size, SignalCommand* command) {
+  JsonReader reader(json, size);
+  bool has_command = false;
+
+  *command = SignalCommand();
+
+  bool read = reader.ReadObject([&](const char* key, std::size_t length) {
+    if (IsName(key, length, "command")) {
+      const char* name;
+      std::size_t name_length;
+      if (!reader.ScanString(&name, &name_length)) return false;
+
+      has_command = true;
+      command->type_ = ToSignalCommandType(name, name_length);
+      return true;
+    }
+
+    if (IsName(key, length, "channel")) return ReadStringValue(reader, &command->channel_);
+    if (IsName(key, length, "peer_id")) return ReadStringValue(reader, &command->peer_id_);
+    if (IsName(key, length, "data")) return ReadData(reader, command);
+    return reader.Skip();
+  });
+
+  return read && has_command && reader.AtEnd();
+}
+
+void EncodeSignalCommand(const SignalCommand& command, std::string* out) {
+  std::size_t reserve = 128 + command.sdp_.size();
+  for (const auto& candidate : command.candidates_) {
+    reserve += 64 + candidate.candidate_.size();
+  }
+
+  out->clear();
+  out->reserve(reserve);
+
+  out->append("{\"command\":\"");
+  out->append(SignalCommandName(command.type_));
+  out->push_back('"');
+
+  if (!command.channel_.empty()) {
+    out->append(",\"channel\":");
+    AppendString(out, command.channel_);
+  }
+
+  if (!command.peer_id_.empty()) {
+    out->append(",\"peer_id\":");
+    AppendString(out, command.peer_id_);
+  }
+
+  out->append(",\"data\":{");
+  bool first = true;
+
+  switch (command.type_) {
+  case SIGNAL_OPEN:
+    // The reply of the signal server has the session id
+    if (!command.session_id_.empty()) {
+      out->append(command.result_ ? "\"result\":true" : "\"result\":false");
+      first = false;
+      AppendMember(out, "session_id", command.session_id_, &first);
+      break;
+    }
+    AppendMember(out, "user_id", command.user_id_, &first);
+    AppendMember(out, "user_password", command.user_password_, &first);
+    break;
+
+  case SIGNAL_CHANNEL_CREATE:
+  case SIGNAL_CHANNEL_JOIN:
+    out->append(command.result_ ? "\"result\":true" : "\"result\":false");
+    first = false;
+    if (!command.desc_.empty()) AppendMember(out, "desc", command.desc_, &first);
+    AppendMember(out, "name", command.name_, &first);
+    break;
+
+  case SIGNAL_CREATE_CHANNEL:
+  case SIGNAL_JOIN_CHANNEL:
+  case SIGNAL_LEAVE_CHANNEL:
+  case SIGNAL_CHANNEL_LEAVE:
+  case SIGNAL_PEER_CLOSED:
+    AppendMember(out, "name", command.name_, &first);
+    break;
+
+  case SIGNAL_CREATE_OFFER:
+    out->append("\"peers\":[");
+    for (std::size_t i = 0; i < command.peers_.size(); ++i) {
+      if (i > 0) out->push_back(',');
+      AppendString(out, command.peers_[i]);
+    }
+    out->push_back(']');
+    break;
+
+  case SIGNAL_OFFER_SDP:
+  case SIGNAL_ANSWER_SDP:
+    AppendMember(out, "sdp", command.sdp_, &first);
+    break;
+
+  case SIGNAL_ICE_CANDIDATE:
+    // One candidate is sent as it was before candidates were batched
+    if (command.candidates_.size() == 1) {
+      AppendCandidate(out, command.candidates_[0]);
+      break;
+    }
+
+    out->append("\"candidates\":[");
+    for (std::size_t i = 0; i < command.candidates_.size(); ++i) {
+      out->append(i > 0 ? ",{" : "{");
+      AppendCandidate(out, command.candidates_[i]);
+      out->push_back('}');
+    }
+    out->push_back(']');
+    break;
+
+  default:
+    break;
+  }
+
+  out->append("}}");
+}
+
+bool DecodeSignalCommandBinary(const char* data, std::size_t size, SignalCommand* command) {
+  BinaryReader reader(data, size);
+  std::size_t remaining = SIGNAL_MAX_UNPACKED_SIZE;
+
+  *command = SignalCommand();
+
+  unsigned char type;
+  if (!reader.ReadByte(&type)) return false;
+  if (type <= SIGNAL_ICE_CANDIDATE) command->type_ = static_cast<SignalCommandType>(type);
+
+  while (!reader.AtEnd()) {
+    unsigned char tag;
+    const char* value;
+    std::size_t length;
+    if (!reader.ReadField(&tag, &value, &length)) return false;
+
+    switch (tag) {
+    case TAG_CHANNEL:       command->channel_.assign(value, length); break;
+    case TAG_PEER_ID:       command->peer_id_.assign(value, length); break;
+    case TAG_RESULT:        command->result_ = length > 0 && value[0] != 0; break;
+    case TAG_USER_ID:       command->user_id_.assign(value, length); break;
+    case TAG_USER_PASSWORD: command->user_password_.assign(value, length); break;
+    case TAG_SESSION_ID:    command->session_id_.assign(value, length); break;
+    case TAG_NAME:          command->name_.assign(value, length); break;
+    case TAG_DESC:          command->desc_.assign(value, length); break;
+    case TAG_PEER:          command->peers_.emplace_back(value, length); break;
+
+    case TAG_SDP:
+      if (!UnpackLines(value, length, &remaining, &command->sdp_)) return false;
+      break;
+
+    case TAG_CANDIDATE:
+      command->candidates_.emplace_back();
+      if (!ReadBinaryCandidate(value, length, &remaining, &command->candidates_.back())) return false;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+void EncodeSignalCommandBinary(const SignalCommand& command, std::string* out) {
+  std::size_t reserve = 64 + command.sdp_.size();
+  for (const auto& candidate : command.candidates_) {
+    reserve += 16 + candidate.candidate_.size();
+  }
+
+  out->clear();
+  out->reserve(reserve);
+
+  out->push_back(static_cast<char>(command.type_));
+
+  AppendField(out, TAG_CHANNEL, command.channel_);
+  AppendField(out, TAG_PEER_ID, command.peer_id_);
+  if (command.result_) AppendField(out, TAG_RESULT, "\x01", 1);
+  AppendField(out, TAG_USER_ID, command.user_id_);
+  AppendField(out, TAG_USER_PASSWORD, command.user_password_);
+  AppendField(out, TAG_SESSION_ID, command.session_id_);
+  AppendField(out, TAG_NAME, command.name_);
+  AppendField(out, TAG_DESC, command.desc_);
+  AppendPackedField(out, TAG_SDP, command.sdp_);
+
+  for (const auto& candidate : command.candidates_) {
+    AppendBinaryCandidate(out, candidate);
+  }
+
+  for (const auto& peer : command.peers_) {
+    AppendField(out, TAG_PEER, peer.data(), peer.size());
+  }
+}
+
+} // namespace peerapi
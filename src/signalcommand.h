@@ -0,0 +1,135 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#ifndef __PEERAPI_SIGNALCOMMAND_H__
+#define __PEERAPI_SIGNALCOMMAND_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace peerapi {
+
+//
+// Commands of the signal server protocol. Peers send the first group, and
+// the signal server sends the second. offersdp, answersdp and ice_candidate
+// are relayed from one peer to another. The binary encoding writes the
+// values of the types, so a new type is added at the end.
+//
+
+enum SignalCommandType {
+  SIGNAL_UNKNOWN = 0,
+
+  // Peer to signal server
+  SIGNAL_OPEN,
+  SIGNAL_CREATE_CHANNEL,
+  SIGNAL_JOIN_CHANNEL,
+  SIGNAL_LEAVE_CHANNEL,
+
+  // Signal server to peer
+  SIGNAL_CHANNEL_CREATE,
+  SIGNAL_CHANNEL_JOIN,
+  SIGNAL_CHANNEL_LEAVE,
+  SIGNAL_PEER_CLOSED,
+  SIGNAL_CREATE_OFFER,
+
+  // Relayed between peers
+  SIGNAL_OFFER_SDP,
+  SIGNAL_ANSWER_SDP,
+  SIGNAL_ICE_CANDIDATE
+};
+
+struct IceCandidateData {
+  std::string sdp_mid_;
+  int sdp_mline_index_ = 0;
+  std::string candidate_;
+};
+
+//
+// struct SignalCommand
+//
+// A signaling message with the members of every command in the "data"
+// object as typed fields. A command uses only some of them:
+//
+//   open            user_id_, user_password_ to the server,
+//                   result_, session_id_ from it
+//   createchannel,
+//   joinchannel,
+//   leavechannel    name_
+//   channelcreate,
+//   channeljoin     result_, name_, desc_
+//   peerclosed      name_
+//   createoffer     peers_
+//   offersdp,
+//   answersdp       sdp_
+//   ice_candidate   candidates_, sent as one candidate if there is one only
+//
+
+struct SignalCommand {
+  SignalCommandType type_ = SIGNAL_UNKNOWN;
+  std::string channel_;     // Channel the command is sent to
+  std::string peer_id_;     // Peer that sent a relayed command
+
+  bool result_ = false;
+  std::string user_id_;
+  std::string user_password_;
+  std::string session_id_;
+  std::string name_;
+  std::string desc_;
+  std::string sdp_;
+  std::vector<IceCandidateData> candidates_;
+  std::vector<std::string> peers_;
+
+  SignalCommand() = default;
+  explicit SignalCommand(SignalCommandType type, const std::string& channel = "")
+      : type_(type), channel_(channel) {}
+};
+
+const char* SignalCommandName(SignalCommandType type);
+SignalCommandType ToSignalCommandType(const char* name, std::size_t length);
+
+//
+// Read a command from JSON text without building a tree of values. Members
+// of other names are skipped. Returns false if the text is not a JSON
+// object, or its "command" is missing.
+//
+
+bool DecodeSignalCommand(const char* json, std::size_t size, SignalCommand* command);
+
+//
+// Write a command as JSON text to |out|, replacing its contents. Only the
+// fields of the command type are written.
+//
+
+void EncodeSignalCommand(const SignalCommand& command, std::string* out);
+
+//
+// A compact binary encoding of commands, used on a WebSocket connection
+// that agreed on the SIGNAL_BINARY_PROTOCOL subprotocol. A command is its
+// type in one byte, followed by fields of a tag byte, a varint length and
+// the value. Fields of unknown tags are skipped and empty fields are left
+// out.
+//
+// Lines of SDP and ICE candidates are written as one byte if WebRTC writes
+// them the same way for every data channel connection, and a common prefix
+// of other lines is written as one byte. The dictionary of these lines is
+// part of the protocol, so changing it needs a new subprotocol name.
+//
+
+const char SIGNAL_BINARY_PROTOCOL[] = "peerapi-binary-1";
+
+// The signal server and clients read WebSocket messages of this size at
+// most. The lines of SDP and ICE candidates of a binary command unpack to
+// SIGNAL_MAX_UNPACKED_SIZE at most, or the command is rejected.
+const std::size_t SIGNAL_MAX_MESSAGE_SIZE = 128 * 1024;
+const std::size_t SIGNAL_MAX_UNPACKED_SIZE = 64 * 1024;
+
+bool DecodeSignalCommandBinary(const char* data, std::size_t size, SignalCommand* command);
+void EncodeSignalCommandBinary(const SignalCommand& command, std::string* out);
+
+} // namespace peerapi
+
+#endif // __PEERAPI_SIGNALCOMMAND_H__
@@ -11,17 +11,23 @@
 #include <map>
 #include <list>
 #include "signalconnection.h"
+#include "common.h"
 #include "logging.h"
 
 namespace peerapi {
 
 Signal::Signal(const string url) :
-      con_state_(con_closed),
       network_thread_(),
-      reconn_attempts_(3),
+      con_state_(con_closed),
+      reconn_delay_(DEFAULT_SIGNAL_RECONNECT_DELAY),
+      reconn_delay_max_(DEFAULT_SIGNAL_RECONNECT_DELAY_MAX),
+      reconn_attempts_(DEFAULT_SIGNAL_RECONNECT_ATTEMPTS),
       reconn_made_(0),
-      reconn_delay_(5000),
-      reconn_delay_max_(25000),
+      retry_made_(0),
+      binary_(false),
+      binary_opened_(false),
+      compression_(),
+      compression_opened_(false),
       url_(url) {
 
 #if _DEBUG || DEBUG
@@ -39,6 +45,7 @@ Signal::Signal(const string url) :
 
   // Initialize ASIO
   client_.init_asio();
+  client_.set_max_message_size(SIGNAL_MAX_MESSAGE_SIZE);
 
   // Bind the handlers we are using
   using websocketpp::lib::placeholders::_1;
@@ -106,12 +113,10 @@ void Signal::SyncClose()
 }
 
 
-void Signal::SendCommand(const string channel,
-                         const string commandname,
-                         const Json::Value& data) {
+void Signal::SendCommand(const SignalCommand& command) {
 
-  if (commandname.empty()) {
-    LOG_F(WARNING) << "SendCommand with empty commandname";
+  if (command.type_ == SIGNAL_UNKNOWN) {
+    LOG_F(WARNING) << "SendCommand with unknown command";
     return;
   }
 
@@ -120,16 +125,23 @@ void Signal::SendCommand(const string channel,
     return;
   }
 
-  Json::Value message;
-  Json::FastWriter writer;
-  message["command"] = commandname;
-  message["data"] = data;
-  if (!channel.empty()) message["channel"] = channel;
+  string message;
+  websocketpp::frame::opcode::value opcode;
 
-  LOG_F( LS_VERBOSE ) << "message is " << message.toStyledString();
+  if (binary_opened_) {
+    EncodeSignalCommandBinary(command, &message);
+    opcode = websocketpp::frame::opcode::binary;
+    LOG_F( LS_VERBOSE ) << "message is " << SignalCommandName(command.type_)
+                        << " of " << message.size() << " bytes";
+  }
+  else {
+    EncodeSignalCommand(command, &message);
+    opcode = websocketpp::frame::opcode::text;
+    LOG_F( LS_VERBOSE ) << "message is " << message;
+  }
 
   try {
-    client_.send(con_hdl_, writer.write(message), websocketpp::frame::opcode::text);
+    client_.send(con_hdl_, message, opcode);
   }
   catch (websocketpp::lib::error_code& ec) {
     LOG_F(LERROR) << "SendCommand Error: " << ec;
@@ -144,11 +156,21 @@ void Signal::SendCommand(const string channel,
   LOG_F( INFO ) << "Done";
 }
 
-void Signal::SendGlobalCommand(const string commandname,
-                               const Json::Value& data) {
-  SendCommand("", commandname, data);
+
+bool Signal::SendCommandLater(const SignalCommand& command)
+{
+  unsigned made = retry_made_++;
+  if (made >= reconn_attempts_) {
+    return false;
+  }
+
+  LOG_F(WARNING) << "Retry " << SignalCommandName(command.type_) << " for attempt:" << made;
+  client_.get_io_service().dispatch(websocketpp::lib::bind(&Signal::StartRetry, this,
+                                    command, NextDelay(made)));
+  return true;
 }
 
+
 void Signal::Connect()
 {
   if (reconn_timer_)
@@ -202,16 +224,16 @@ asio::io_service& Signal::GetIoService()
 
 
 void Signal::SendOpenCommand() {
-  Json::Value data;
+  SignalCommand command(SIGNAL_OPEN);
 
-  data["user_id"] = user_id_;
-  data["user_password"] = user_password_;
+  command.user_id_ = user_id_;
+  command.user_password_ = user_password_;
 
-  SendGlobalCommand("open", data);
+  SendCommand(command);
 }
 
-void Signal::OnCommandReceived(Json::Value& message) {
-  SignalOnCommandReceived_(message);
+void Signal::OnCommandReceived(const SignalCommand& command) {
+  SignalOnCommandReceived_(command);
   return;
 }
 
@@ -225,6 +247,15 @@ void Signal::RunLoop()
 
 void Signal::ConnectInternal()
 {
+#if defined(PEERAPI_SIGNAL_DEFLATE)
+    // The connection takes its permessage-deflate settings from this thread
+    SignalDeflate<client_config::base::permessage_deflate_config>::set_thread_setting(compression_);
+#else
+    if (compression_.enabled_) {
+      LOG_F(WARNING) << "Signal compression needs zlib, connecting without it";
+    }
+#endif
+
     websocketpp::lib::error_code ec;
     client_type::connection_ptr con = client_.get_connection(url_, ec);
     if (ec) {
@@ -233,6 +264,11 @@ void Signal::ConnectInternal()
       return;
     }
 
+    // A server not knowing the subprotocol ignores it and JSON is used
+    if (binary_) {
+      con->add_subprotocol(SIGNAL_BINARY_PROTOCOL, ec);
+    }
+
     client_.connect(con);
     return;
 }
@@ -248,6 +284,11 @@ void Signal::CloseInternal(websocketpp::close::status::value const& code, string
     reconn_timer_->cancel();
     reconn_timer_.reset();
   }
+  if (retry_timer_)
+  {
+    retry_timer_->cancel();
+    retry_timer_.reset();
+  }
   if (con_hdl_.expired())
   {
     LOG_F(LERROR) << "Error: No active session";
@@ -276,20 +317,54 @@ void Signal::TimeoutReconnect(websocketpp::lib::asio::error_code const& ec)
   }
 }
 
-unsigned Signal::NextDelay() const
+void Signal::StartRetry(const SignalCommand& command, unsigned delay)
+{
+  retry_timer_.reset(new asio::steady_timer(client_.get_io_service()));
+  websocketpp::lib::asio::error_code ec;
+  retry_timer_->expires_from_now(websocketpp::lib::asio::milliseconds(delay), ec);
+  retry_timer_->async_wait(websocketpp::lib::bind(&Signal::TimeoutRetry, this, command,
+                                                  websocketpp::lib::placeholders::_1));
+}
+
+void Signal::TimeoutRetry(const SignalCommand& command, websocketpp::lib::asio::error_code const& ec)
+{
+  if (ec)
+  {
+    return;
+  }
+
+  // A connection lost meanwhile sends 'open' and the command again itself
+  if (opened())
+  {
+    SendCommand(command);
+  }
+}
+
+unsigned Signal::NextDelay(unsigned made) const
 {
   //no jitter, fixed power root.
-  unsigned reconn_made = std::min<unsigned>(reconn_made_, 32);//protect the pow result to be too big.
-  return static_cast<unsigned>(std::min<double>(reconn_delay_ * pow(1.5, reconn_made), reconn_delay_max_));
+  made = std::min<unsigned>(made, 32);//protect the pow result to be too big.
+  return static_cast<unsigned>(std::min<double>(reconn_delay_ * pow(1.5, made), reconn_delay_max_));
 }
 
 
 void Signal::OnOpen(websocketpp::connection_hdl con)
 {
-  LOG_F(WARNING) << "Connected.";
+  websocketpp::lib::error_code ec;
+  client_type::connection_ptr conn_ptr = client_.get_con_from_hdl(con, ec);
+  // websocketpp keeps the subprotocol selected by a server only, so a client
+  // reads it from the handshake response
+  binary_opened_ = !ec &&
+      conn_ptr->get_response_header("Sec-WebSocket-Protocol") == SIGNAL_BINARY_PROTOCOL;
+  compression_opened_ = !ec &&
+      conn_ptr->get_response_header("Sec-WebSocket-Extensions").find("permessage-deflate") != string::npos;
+
+  LOG_F(WARNING) << "Connected" << (binary_opened_ ? " with binary encoding" : "")
+                 << (compression_opened_ ? " with compression." : ".");
   con_state_ = con_opened;
   con_hdl_ = con;
   reconn_made_ = 0;
+  retry_made_ = 0;
 
   SendOpenCommand();
 }
@@ -322,20 +397,20 @@ void Signal::OnClose(websocketpp::connection_hdl con)
   else
   {
     //
-    // TODO: Implement seamless signal reconnection. Don't close existing ice connection.
-    //  Reconstruction of (creating and joining) channel has to be implemented.
+    // Reconnect without telling Control, so existing ice connections are
+    // kept. OnOpen() sends 'open' again and Control re-creates the channel.
     //
 
-    //if (reconn_made_<reconn_attempts_)
-    //{
-    //  LOG_F(LS_WARNING) << "Reconnect for attempt:" << reconn_made_;
-    //  unsigned delay = this->NextDelay();
-    //  reconn_timer_.reset(new websocketpp::lib::asio::steady_timer(client_.get_io_service()));
-    //  websocketpp::lib::asio::error_code ec;
-    //  reconn_timer_->expires_from_now(websocketpp::lib::asio::milliseconds(delay), ec);
-    //  reconn_timer_->async_wait(websocketpp::lib::bind(&Signal::TimeoutReconnect, this, websocketpp::lib::placeholders::_1));
-    //  return;
-    //}
+    if (reconn_made_<reconn_attempts_)
+    {
+      LOG_F(WARNING) << "Reconnect for attempt:" << reconn_made_;
+      unsigned delay = this->NextDelay(reconn_made_);
+      reconn_timer_.reset(new asio::steady_timer(client_.get_io_service()));
+      websocketpp::lib::asio::error_code ec;
+      reconn_timer_->expires_from_now(websocketpp::lib::asio::milliseconds(delay), ec);
+      reconn_timer_->async_wait(websocketpp::lib::bind(&Signal::TimeoutReconnect, this, websocketpp::lib::placeholders::_1));
+      return;
+    }
 
     SignalOnClosed_(code);
   }
@@ -369,7 +444,7 @@ void Signal::OnFail(websocketpp::connection_hdl con)
   if (reconn_made_<reconn_attempts_)
   {
     LOG_F(WARNING) << "Reconnect for attempt:" << reconn_made_;
-    unsigned delay = this->NextDelay();
+    unsigned delay = this->NextDelay(reconn_made_);
     reconn_timer_.reset(new asio::steady_timer(client_.get_io_service()));
     websocketpp::lib::asio::error_code ec;
     reconn_timer_->expires_from_now(websocketpp::lib::asio::milliseconds(delay), ec);
@@ -383,16 +458,25 @@ void Signal::OnFail(websocketpp::connection_hdl con)
 
 void Signal::OnMessage(websocketpp::connection_hdl con, client_type::message_ptr msg)
 {
-  Json::Reader reader;
-  Json::Value jmessage;
+  const string& payload = msg->get_payload();
+  SignalCommand command;
 
-  if (!reader.parse(msg->get_payload(), jmessage)) {
-    LOG_F(WARNING) << "Received unknown message: " << msg->get_payload();
-    return;
+  if (msg->get_opcode() == websocketpp::frame::opcode::binary) {
+    if (!DecodeSignalCommandBinary(payload.data(), payload.size(), &command)) {
+      LOG_F(WARNING) << "Received unknown binary message of " << payload.size() << " bytes";
+      return;
+    }
+    LOG_F( LS_VERBOSE ) << SignalCommandName(command.type_) << " of " << payload.size() << " bytes";
+  }
+  else {
+    if (!DecodeSignalCommand(payload.data(), payload.size(), &command)) {
+      LOG_F(WARNING) << "Received unknown message: " << payload;
+      return;
+    }
+    LOG_F( LS_VERBOSE ) << payload;
   }
 
-  LOG_F( LS_VERBOSE ) << jmessage.toStyledString();
-  OnCommandReceived(jmessage);
+  OnCommandReceived(command);
 }
 
 
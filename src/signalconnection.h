@@ -33,6 +33,7 @@
 #ifndef __PEERAPI_SIGNAL_H__
 #define __PEERAPI_SIGNAL_H__
 
+#include <atomic>
 #include <string>
 
 #if _DEBUG || DEBUG
@@ -45,7 +46,13 @@
 #include "websocketpp/common/thread.hpp"
 
 #include "rtc_base/third_party/sigslot/sigslot.h"
-#include "rtc_base/strings/json.h"
+
+#include "common.h"
+#include "signalcommand.h"
+
+#if defined(PEERAPI_SIGNAL_DEFLATE)
+#include "signaldeflate.h"
+#endif
 
 namespace peerapi {
 
@@ -54,15 +61,11 @@ public:
   virtual void Open(const std::string& id, const std::string& password) = 0;
   virtual void Close() = 0;
 
-  virtual void SendCommand(const std::string id,
-                           const std::string commandname,
-                           const Json::Value& data) = 0;
-  virtual void SendGlobalCommand(const std::string commandname,
-                           const Json::Value& data) = 0;
+  virtual void SendCommand(const SignalCommand& command) = 0;
   std::string session_id() { return session_id_; }
  
   // sigslots
-  sigslot::signal1<const Json::Value&> SignalOnCommandReceived_;
+  sigslot::signal1<const SignalCommand&> SignalOnCommandReceived_;
   sigslot::signal1<const websocketpp::close::status::value> SignalOnClosed_;
 
 
@@ -85,10 +88,20 @@ public:
   using string = std::string;
 
 #if _DEBUG || DEBUG
-  typedef websocketpp::config::debug_asio_tls client_config;
+  typedef websocketpp::config::debug_asio_tls client_config_base;
 #else
-  typedef websocketpp::config::asio_tls_client client_config;
+  typedef websocketpp::config::asio_tls_client client_config_base;
 #endif //DEBUG
+
+  struct client_config : public client_config_base {
+    typedef client_config type;
+    typedef client_config_base base;
+
+#if defined(PEERAPI_SIGNAL_DEFLATE)
+    typedef SignalDeflate<base::permessage_deflate_config> permessage_deflate_type;
+#endif
+  };
+
   typedef websocketpp::client<client_config> client_type;
 
   Signal(const string url);
@@ -98,11 +111,12 @@ public:
   void Close();
   void SyncClose();
 
-  void SendCommand(const string channel,
-                   const string commandname,
-                   const Json::Value& data);
-  void SendGlobalCommand(const string commandname,
-                         const Json::Value& data);
+  void SendCommand(const SignalCommand& command);
+
+  // Sends |command| again after a reconnect delay, for a command the server
+  // refused for now. Returns false once reconnect attempts are used up since
+  // the connection opened.
+  bool SendCommandLater(const SignalCommand& command);
 
   void Teardown();
 
@@ -111,6 +125,16 @@ public:
   void set_reconnect_delay(unsigned millis) { reconn_delay_ = millis; if (reconn_delay_max_<millis) reconn_delay_max_ = millis; }
   void set_reconnect_delay_max(unsigned millis) { reconn_delay_max_ = millis; if (reconn_delay_>millis) reconn_delay_ = millis; }
 
+  // Offers the binary encoding on the next connection, used if the server
+  // agrees to it. JSON is used otherwise.
+  void set_binary(bool binary) { binary_ = binary; }
+  bool binary_opened() const { return binary_opened_; }
+
+  // Offers permessage-deflate on the next connection. It is used if the
+  // server agrees to it and the library is built with zlib.
+  void set_compression(const SignalCompressionSetting& compression) { compression_ = compression; }
+  bool compression_opened() const { return compression_opened_; }
+
 
 protected:
   void Connect();
@@ -118,13 +142,15 @@ protected:
 
 private:
   void SendOpenCommand();
-  void OnCommandReceived(Json::Value& message);
+  void OnCommandReceived(const SignalCommand& command);
 
   void RunLoop();
   void ConnectInternal();
   void CloseInternal(websocketpp::close::status::value const& code, string const& desc);
   void TimeoutReconnect(websocketpp::lib::asio::error_code const& ec);
-  unsigned NextDelay() const;
+  void StartRetry(const SignalCommand& command, unsigned delay);
+  void TimeoutRetry(const SignalCommand& command, websocketpp::lib::asio::error_code const& ec);
+  unsigned NextDelay(unsigned made) const;
 
   //websocket callbacks
   void OnFail(websocketpp::connection_hdl con);
@@ -143,12 +169,19 @@ private:
 
   std::unique_ptr<std::thread> network_thread_;
   std::unique_ptr<websocketpp::lib::asio::steady_timer> reconn_timer_;
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> retry_timer_;
   con_state con_state_;
 
   unsigned reconn_delay_;
   unsigned reconn_delay_max_;
   unsigned reconn_attempts_;
   unsigned reconn_made_;
+  std::atomic<unsigned> retry_made_;
+
+  bool binary_;
+  bool binary_opened_;
+  SignalCompressionSetting compression_;
+  bool compression_opened_;
 
   // Signal server
   string url_;
@@ -0,0 +1,92 @@
+/*
+ *  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+ *
+ *  Ryan Lee
+ */
+
+#ifndef __PEERAPI_SIGNALDEFLATE_H__
+#define __PEERAPI_SIGNALDEFLATE_H__
+
+#include <string>
+
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+#include "common.h"
+
+namespace peerapi {
+
+//
+// class SignalDeflate
+//
+// permessage-deflate of websocketpp for class Signal, with the window bits,
+// memory level and context takeover of a SignalCompressionSetting.
+//
+// websocketpp creates the extension of a connection itself, with no way to
+// pass it settings. A connection is made on the network thread of its
+// Signal, so the settings are those of that thread, set by
+// set_thread_setting() before the connection is made.
+//
+
+template <typename config>
+class SignalDeflate
+  : public websocketpp::extensions::permessage_deflate::enabled<config> {
+public:
+  typedef websocketpp::extensions::permessage_deflate::enabled<config> base;
+
+  SignalDeflate() : setting_(thread_setting()) {
+    namespace mode = websocketpp::extensions::permessage_deflate::mode;
+
+    // A smaller window answered by the server is used instead. Received
+    // messages are inflated with the window the server answers, or the
+    // largest one.
+    base::set_client_max_window_bits(static_cast<uint8_t>(setting_.client_max_window_bits_),
+                                     mode::largest);
+    base::set_memory_level(setting_.memory_level_);
+
+    if (setting_.client_no_context_takeover_) {
+      base::enable_client_no_context_takeover();
+    }
+  }
+
+  // Hides the fixed offer of websocketpp. An empty offer disables the
+  // extension.
+  std::string generate_offer() const {
+    if (!setting_.enabled_) return std::string();
+
+    std::string offer = "permessage-deflate";
+
+    if (setting_.client_no_context_takeover_) {
+      offer += "; client_no_context_takeover";
+    }
+    if (setting_.server_no_context_takeover_) {
+      offer += "; server_no_context_takeover";
+    }
+    if (setting_.server_max_window_bits_ < 15) {
+      offer += "; server_max_window_bits=" + std::to_string(setting_.server_max_window_bits_);
+    }
+
+    // Tells the server it may ask for a smaller window
+    offer += "; client_max_window_bits";
+    if (setting_.client_max_window_bits_ < 15) {
+      offer += "=" + std::to_string(setting_.client_max_window_bits_);
+    }
+
+    return offer;
+  }
+
+  static SignalCompressionSetting& thread_setting() {
+    static thread_local SignalCompressionSetting setting;
+    return setting;
+  }
+
+  static void set_thread_setting(const SignalCompressionSetting& setting) {
+    thread_setting() = setting;
+  }
+
+private:
+  SignalCompressionSetting setting_;
+};
+
+} // namespace peerapi
+
+#endif // __PEERAPI_SIGNALDEFLATE_H__
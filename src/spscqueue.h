@@ -0,0 +1,101 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+#ifndef __PEERAPI_SPSCQUEUE_H__
+#define __PEERAPI_SPSCQUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace peerapi {
+
+//
+// class SpscQueue
+//
+// A bounded lock-free queue with one producer thread and one consumer
+// thread. Push() never waits and fails if the queue is full. The capacity is
+// rounded up to a power of two.
+//
+// Each side caches the index of the other one, so an atomic written by the
+// other thread is read only when the queue looks full or empty.
+//
+
+template <typename T>
+class SpscQueue {
+public:
+  explicit SpscQueue(std::size_t capacity)
+      : mask_(RoundUp(capacity) - 1),
+        slots_(mask_ + 1),
+        tail_(0),
+        head_cache_(0),
+        head_(0),
+        tail_cache_(0) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Called by the producer only
+  bool Push(T&& item) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail - head_cache_ > mask_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ > mask_) return false;
+    }
+
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Called by the consumer only. The slot is moved from, so it does not
+  // keep a reference to the item.
+  bool Pop(T& item) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) return false;
+    }
+
+    item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  // Exact only on the consumer thread while the producer is idle
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+private:
+  static std::size_t RoundUp(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity) size <<= 1;
+    return size;
+  }
+
+  // Keep the indexes of the producer and the consumer on cache lines of
+  // their own, so one side writing does not evict the other.
+  static const std::size_t kCacheLine = 64;
+
+  const std::size_t mask_;
+  std::vector<T> slots_;
+
+  alignas(kCacheLine) std::atomic<std::size_t> tail_;
+  std::size_t head_cache_;
+
+  alignas(kCacheLine) std::atomic<std::size_t> head_;
+  std::size_t tail_cache_;
+};
+
+} // namespace peerapi
+
+#endif // __PEERAPI_SPSCQUEUE_H__
@@ -0,0 +1,334 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+//
+// peerapi_bench
+//
+// Connects pairs of peers over loopback through an embedded signal server,
+// so it runs offline. For every combination of message size, peer count
+// and send mode it reports connection setup time, throughput, message rate
+// and one-way latency percentiles.
+//
+// Usage: peerapi_bench [--sizes 64,1024,16384,65536] [--peers 1,4]
+//                      [--modes async,sync] [--bytes 16777216]
+//                      [--threading single|dedicated] [--shared_factory]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "peerapi.h"
+#include "server/signalserver.h"
+
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  vector<size_t> sizes_ = { 64, 1024, 16 * 1024, 64 * 1024 };
+  vector<size_t> peers_ = { 1, 4 };
+  vector<bool> sync_ = { false, true };
+  size_t bytes_ = 16 * 1024 * 1024;
+  string threading_ = "single";
+  bool shared_factory_ = false;
+};
+
+struct Result {
+  bool ok_ = false;
+  size_t messages_ = 0;
+  double setup_ms_ = 0;
+  double throughput_ = 0;
+  double rate_ = 0;
+  int64_t p50_ = 0;
+  int64_t p99_ = 0;
+  int64_t p999_ = 0;
+};
+
+// Async sends in flight for each pair
+const size_t kMaxInFlight = 64;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    Clock::now().time_since_epoch()).count();
+}
+
+vector<size_t> ParseList(const string& value) {
+  vector<size_t> list;
+  stringstream stream(value);
+  string item;
+  while (getline(stream, item, ',')) {
+    list.push_back(stoul(item));
+  }
+  return list;
+}
+
+bool ParseArgs(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    string value = i + 1 < argc ? argv[i + 1] : "";
+
+    if (arg == "--sizes") { options.sizes_ = ParseList(value); ++i; }
+    else if (arg == "--peers") { options.peers_ = ParseList(value); ++i; }
+    else if (arg == "--bytes") { options.bytes_ = stoul(value); ++i; }
+    else if (arg == "--threading") { options.threading_ = value; ++i; }
+    else if (arg == "--shared_factory") { options.shared_factory_ = true; }
+    else if (arg == "--modes") {
+      options.sync_.clear();
+      if (value.find("async") != string::npos) options.sync_.push_back(false);
+      if (value.find("sync") == 0 || value.find(",sync") != string::npos) options.sync_.push_back(true);
+      ++i;
+    }
+    else {
+      cerr << "Unknown argument: " << arg << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// Send |messages| messages stamped with the send time. A sync send blocks
+// until the data has left the data channel, async sends keep a window of
+// kMaxInFlight sends. Runs on a thread of its own, because a send waiting
+// for completion must not block the thread running Peer::Run().
+//
+
+void SendMessages(Peer* peer, const string to, size_t size, size_t messages, bool sync) {
+  deque<future<bool>> in_flight;
+
+  for (size_t i = 0; i < messages; ++i) {
+    Buffer buffer(size);
+    memset(buffer.data(), 0, size);
+    int64_t now = NowNanos();
+    memcpy(buffer.data(), &now, sizeof(now));
+
+    if (sync) {
+      if (!peer->Send(to, buffer, SYNC_ON)) {
+        cerr << "Send failed" << endl;
+        return;
+      }
+      continue;
+    }
+
+    if (in_flight.size() >= kMaxInFlight) {
+      if (!in_flight.front().get()) {
+        cerr << "SendAsync failed" << endl;
+        return;
+      }
+      in_flight.pop_front();
+    }
+    in_flight.push_back(peer->SendAsync(to, buffer));
+  }
+
+  for (auto& sent : in_flight) {
+    sent.wait();
+  }
+}
+
+Result RunBenchmark(const string& url, const Options& options,
+                    size_t size, size_t peer_count, bool sync) {
+
+  enum PeerState { IDLE, OPEN, CLOSED };
+
+  struct Pair {
+    unique_ptr<Peer> server_;
+    unique_ptr<Peer> client_;
+    string server_id_;
+    string client_id_;
+    PeerState server_state_ = IDLE;
+    PeerState client_state_ = IDLE;
+    Clock::time_point connect_start_;
+    thread sender_;
+  };
+
+  size = max(size, sizeof(int64_t));
+  const size_t messages = max<size_t>(100, options.bytes_ / size);
+  const size_t total = messages * peer_count;
+
+  // Peers connect on loopback, so host candidates are enough
+  std::ostringstream setting;
+  setting << R"({ "url" : ")" << url << R"(", "host_only" : true, "threading" : ")" << options.threading_
+          << R"(", "shared_factory" : )" << (options.shared_factory_ ? "true" : "false") << " }";
+
+  Result result;
+  vector<unique_ptr<Pair>> pairs;
+  vector<int64_t> latencies;
+  latencies.reserve(total);
+
+  size_t connected = 0;
+  size_t closed = 0;
+  bool closing = false;
+  double setup_ms = 0;
+  Clock::time_point start;
+  Clock::time_point end;
+
+  auto close_all = [&]() {
+    if (closing) return;
+    closing = true;
+
+    for (auto& pair : pairs) {
+      for (auto state : { &pair->client_state_, &pair->server_state_ }) {
+        if (*state == IDLE) {
+          *state = CLOSED;
+          ++closed;
+        }
+      }
+      if (pair->client_state_ == OPEN) pair->client_->Close();
+      if (pair->server_state_ == OPEN) pair->server_->Close();
+    }
+
+    if (closed == peer_count * 2) Peer::Stop();
+  };
+
+  auto on_closed = [&](PeerState& state) {
+    state = CLOSED;
+    if (++closed == peer_count * 2) {
+      Peer::Stop();
+      return;
+    }
+    close_all();
+  };
+
+  for (size_t i = 0; i < peer_count; ++i) {
+    unique_ptr<Pair> pair(new Pair);
+    Pair* p = pair.get();
+
+    p->server_id_ = Peer::CreateRandomUuid();
+    p->client_id_ = Peer::CreateRandomUuid();
+    p->server_.reset(new Peer(p->server_id_));
+    p->client_.reset(new Peer(p->client_id_));
+    p->server_->SetOptions(setting.str());
+    p->client_->SetOptions(setting.str());
+
+    p->server_->On("open", [&, p]( string peer_id ) {
+      p->client_state_ = OPEN;
+      p->client_->Open();
+    });
+
+    p->server_->On("close", [&, p]( string peer_id, CloseCode code, string desc ) {
+      if (peer_id == p->server_id_) on_closed(p->server_state_);
+      else if (latencies.size() < total) close_all();
+    });
+
+    p->server_->On("message", [&, p]( const PeerHandle& peer, char* data, size_t length ) {
+      int64_t sent;
+      memcpy(&sent, data, sizeof(sent));
+      latencies.push_back(NowNanos() - sent);
+
+      if (latencies.size() == total) {
+        end = Clock::now();
+        result.ok_ = true;
+        close_all();
+      }
+    });
+
+    p->client_->On("open", [&, p]( string peer_id ) {
+      p->connect_start_ = Clock::now();
+      p->client_->Connect(p->server_id_);
+    });
+
+    p->client_->On("connect", [&, p]( string peer_id ) {
+      setup_ms += chrono::duration<double, milli>(Clock::now() - p->connect_start_).count();
+      if (++connected < peer_count) return;
+
+      // Every pair is connected, start sending at once
+      start = Clock::now();
+      for (auto& each : pairs) {
+        each->sender_ = thread(SendMessages, each->client_.get(), each->server_id_, size, messages, sync);
+      }
+    });
+
+    p->client_->On("close", [&, p]( string peer_id, CloseCode code, string desc ) {
+      if (peer_id == p->client_id_) on_closed(p->client_state_);
+      else if (latencies.size() < total) close_all();
+    });
+
+    pairs.push_back(move(pair));
+  }
+
+  for (auto& pair : pairs) {
+    pair->server_state_ = OPEN;
+    pair->server_->Open();
+  }
+
+  Peer::Run();
+
+  for (auto& pair : pairs) {
+    if (pair->sender_.joinable()) pair->sender_.join();
+  }
+
+  if (!result.ok_ || latencies.empty()) {
+    return result;
+  }
+
+  sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    size_t index = min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+    return latencies[index] / 1000;
+  };
+
+  double seconds = chrono::duration<double>(end - start).count();
+
+  result.messages_ = total;
+  result.setup_ms_ = setup_ms / peer_count;
+  result.throughput_ = total * size / seconds / (1000 * 1000);
+  result.rate_ = total / seconds;
+  result.p50_ = percentile(0.50);
+  result.p99_ = percentile(0.99);
+  result.p999_ = percentile(0.999);
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseArgs(argc, argv, options)) {
+    return 1;
+  }
+
+  peerapi::SignalServer server;
+  if (!server.Start(0, PEERAPI_BENCH_CERTIFICATE)) {
+    cerr << "Failed to start signal server" << endl;
+    return 1;
+  }
+
+  printf("%8s %6s %6s %10s %10s %10s %10s %10s %10s\n",
+         "size", "peers", "mode", "setup_ms", "MB/s", "msg/s", "p50_us", "p99_us", "p999_us");
+
+  int failed = 0;
+
+  for (bool sync : options.sync_) {
+    for (size_t peer_count : options.peers_) {
+      for (size_t size : options.sizes_) {
+        Result result = RunBenchmark(server.local_url(), options, size, peer_count, sync);
+        const char* mode = sync ? "sync" : "async";
+
+        if (!result.ok_) {
+          printf("%8zu %6zu %6s %10s\n", size, peer_count, mode, "FAILED");
+          ++failed;
+          continue;
+        }
+
+        printf("%8zu %6zu %6s %10.1f %10.1f %10.0f %10lld %10lld %10lld\n",
+               size, peer_count, mode, result.setup_ms_, result.throughput_, result.rate_,
+               (long long) result.p50_, (long long) result.p99_, (long long) result.p999_);
+        fflush(stdout);
+      }
+    }
+  }
+
+  server.Stop();
+  return failed == 0 ? 0 : 1;
+}
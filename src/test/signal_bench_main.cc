@@ -0,0 +1,452 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+//
+// signal_bench
+//
+// Runs the signaling of a connection setup between pairs of Signal clients
+// through an embedded signal server, for each encoding and compression
+// setting. A setup connects both clients, then exchanges the channel
+// commands, an offer, an answer and ICE candidates as class Control does.
+//
+// Bytes on the wire are read from the counters of the loopback interface,
+// so they include TLS, TCP and IP headers, and other loopback traffic of
+// the host if there is any. They are reported on Linux only. CPU time is of
+// the whole process, both clients and the server.
+//
+// Usage: signal_bench [--setups 50] [--encodings json,binary]
+//                     [--compressions off,default,small,nocontext]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "signalconnection.h"
+#include "server/signalserver.h"
+
+using namespace std;
+using namespace peerapi;
+
+using Clock = std::chrono::steady_clock;
+
+struct Compression {
+  string name_;
+  SignalCompressionSetting setting_;
+};
+
+struct Options {
+  size_t setups_ = 50;
+  vector<string> encodings_ = { "json", "binary" };
+  vector<string> compressions_ = { "off", "default", "small", "nocontext" };
+};
+
+struct Cost {
+  double wall_ms_ = 0;
+  double cpu_ms_ = 0;
+  int64_t wire_bytes_ = 0;
+};
+
+struct Result {
+  bool ok_ = false;
+  bool compressed_ = false;
+  size_t payload_bytes_ = 0;
+  Cost connect_;
+  Cost exchange_;
+};
+
+// ICE candidates each client sends, one command each
+const size_t kCandidates = 4;
+
+// A client waits this long for each step
+const auto kTimeout = std::chrono::seconds(10);
+
+vector<string> ParseList(const string& value) {
+  vector<string> list;
+  stringstream stream(value);
+  string item;
+  while (getline(stream, item, ',')) {
+    list.push_back(item);
+  }
+  return list;
+}
+
+bool ParseArgs(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    string value = i + 1 < argc ? argv[i + 1] : "";
+
+    if (arg == "--setups") { options.setups_ = stoul(value); ++i; }
+    else if (arg == "--encodings") { options.encodings_ = ParseList(value); ++i; }
+    else if (arg == "--compressions") { options.compressions_ = ParseList(value); ++i; }
+    else {
+      cerr << "Unknown argument: " << arg << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FindCompression(const string& name, Compression* compression) {
+  compression->name_ = name;
+  SignalCompressionSetting& setting = compression->setting_;
+
+  if (name == "off") return true;
+
+  setting.enabled_ = true;
+  if (name == "default") return true;
+
+  // Least memory for a mobile client
+  if (name == "small") {
+    setting.client_max_window_bits_ = 10;
+    setting.server_max_window_bits_ = 10;
+    setting.memory_level_ = 2;
+    return true;
+  }
+
+  if (name == "nocontext") {
+    setting.client_no_context_takeover_ = true;
+    setting.server_no_context_takeover_ = true;
+    return true;
+  }
+
+  return false;
+}
+
+double CpuMillis() {
+  return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+}
+
+// Bytes sent on the loopback interface, or 0 if they are not known
+int64_t LoopbackBytes() {
+  ifstream dev("/proc/net/dev");
+  string line;
+
+  while (getline(dev, line)) {
+    size_t colon = line.find(':');
+    if (colon == string::npos) continue;
+
+    string name = line.substr(0, colon);
+    name.erase(0, name.find_first_not_of(' '));
+    if (name != "lo") continue;
+
+    // Received bytes, packets, errs, drop, fifo, frame, compressed,
+    // multicast, then sent bytes
+    stringstream fields(line.substr(colon + 1));
+    int64_t value = 0;
+    for (int i = 0; i < 9; ++i) fields >> value;
+    return value;
+  }
+
+  return 0;
+}
+
+struct Sample {
+  Clock::time_point wall_;
+  double cpu_;
+  int64_t wire_;
+
+  static Sample Now() { return { Clock::now(), CpuMillis(), LoopbackBytes() }; }
+
+  void AddTo(const Sample& start, Cost* cost) const {
+    cost->wall_ms_ += chrono::duration<double, milli>(wall_ - start.wall_).count();
+    cost->cpu_ms_ += cpu_ - start.cpu_;
+    cost->wire_bytes_ += wire_ - start.wire_;
+  }
+};
+
+
+//
+// Text of the size and shape WebRTC writes for a data channel connection,
+// with the random parts of a real one
+//
+
+class SdpMaker {
+public:
+  string Token(size_t length, const char* alphabet) {
+    string token;
+    size_t size = strlen(alphabet);
+    for (size_t i = 0; i < length; ++i) token.push_back(alphabet[random_() % size]);
+    return token;
+  }
+
+  string Fingerprint() {
+    static const char kHex[] = "0123456789ABCDEF";
+    string fingerprint;
+    for (int i = 0; i < 32; ++i) {
+      if (i > 0) fingerprint.push_back(':');
+      fingerprint.push_back(kHex[random_() % 16]);
+      fingerprint.push_back(kHex[random_() % 16]);
+    }
+    return fingerprint;
+  }
+
+  string Sdp(bool offer) {
+    static const char kIce[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+/";
+    return "v=0\r\n"
+           "o=- " + Token(19, "0123456789") + " 2 IN IP4 127.0.0.1\r\n"
+           "s=-\r\n"
+           "t=0 0\r\n"
+           "a=group:BUNDLE data\r\n"
+           "a=msid-semantic: WMS\r\n"
+           "m=application 9 DTLS/SCTP 5000\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "a=ice-ufrag:" + Token(4, kIce) + "\r\n"
+           "a=ice-pwd:" + Token(24, kIce) + "\r\n"
+           "a=ice-options:trickle\r\n"
+           "a=fingerprint:sha-256 " + Fingerprint() + "\r\n" +
+           (offer ? "a=setup:actpass\r\n" : "a=setup:active\r\n") +
+           "a=mid:data\r\n"
+           "a=sctpmap:5000 webrtc-datachannel 1024\r\n";
+  }
+
+  IceCandidateData Candidate(size_t index) {
+    static const char* const kTypes[] = { "host", "host", "srflx", "host" };
+    const string foundation = Token(10, "0123456789");
+    const string port = to_string(40000 + random_() % 20000);
+
+    IceCandidateData candidate;
+    candidate.sdp_mid_ = "data";
+    candidate.sdp_mline_index_ = 0;
+
+    if (index == 3) {
+      candidate.candidate_ = "candidate:" + foundation + " 1 tcp 1518280447 192.168.1." +
+                             to_string(random_() % 250 + 2) + " 9 typ host tcptype active generation 0 "
+                             "ufrag " + Token(4, "abcdefghijklmnopqrstuvwxyz") + " network-id 1 network-cost 10";
+    }
+    else {
+      candidate.candidate_ = "candidate:" + foundation + " 1 udp 2122260223 192.168.1." +
+                             to_string(random_() % 250 + 2) + " " + port + " typ " + kTypes[index] +
+                             (index == 2 ? " raddr 192.168.1.2 rport " + port : string()) +
+                             " generation 0 ufrag " + Token(4, "abcdefghijklmnopqrstuvwxyz") +
+                             " network-id 1 network-cost 10";
+    }
+    return candidate;
+  }
+
+private:
+  std::mt19937 random_ { 7 };
+};
+
+
+//
+// A client counting the commands it received
+//
+
+class Client : public sigslot::has_slots<> {
+public:
+  Client(const string& url, const string& name) : signal_(url), name_(name) {
+    signal_.SignalOnCommandReceived_.connect(this, &Client::OnCommand);
+  }
+
+  ~Client() {
+    signal_.SignalOnCommandReceived_.disconnect(this);
+  }
+
+  void OnCommand(const SignalCommand& command) {
+    lock_guard<mutex> lock(lock_);
+
+    switch (command.type_) {
+    case SIGNAL_OPEN:           opened_ = command.result_; break;
+    case SIGNAL_CHANNEL_CREATE: created_ = command.result_; break;
+    case SIGNAL_CHANNEL_JOIN:   joined_ = command.result_; break;
+    case SIGNAL_CREATE_OFFER:   offer_to_ = command.peers_.empty() ? "" : command.peers_[0]; break;
+    case SIGNAL_OFFER_SDP:
+    case SIGNAL_ANSWER_SDP:     sdp_ = command.sdp_; break;
+    case SIGNAL_ICE_CANDIDATE:  candidates_ += command.candidates_.size(); break;
+    default: break;
+    }
+
+    changed_.notify_all();
+  }
+
+  template <typename F>
+  bool Wait(F done) {
+    unique_lock<mutex> lock(lock_);
+    return changed_.wait_for(lock, kTimeout, done);
+  }
+
+  Signal signal_;
+  string name_;
+
+  mutex lock_;
+  condition_variable changed_;
+  bool opened_ = false;
+  bool created_ = false;
+  bool joined_ = false;
+  string offer_to_;
+  string sdp_;
+  size_t candidates_ = 0;
+};
+
+size_t Send(Client& client, const SignalCommand& command, bool binary) {
+  string message;
+  if (binary) EncodeSignalCommandBinary(command, &message);
+  else EncodeSignalCommand(command, &message);
+
+  client.signal_.SendCommand(command);
+  return message.size();
+}
+
+//
+// The signaling of one connection setup. |a| owns the channel |b| joins,
+// so |a| is asked to make the offer.
+//
+
+bool Exchange(Client& a, Client& b, SdpMaker& maker, bool binary, size_t* payload) {
+  SignalCommand create(SIGNAL_CREATE_CHANNEL, a.name_);
+  *payload += Send(a, create, binary);
+  create.channel_ = b.name_;
+  *payload += Send(b, create, binary);
+
+  if (!a.Wait([&] { return a.created_; }) || !b.Wait([&] { return b.created_; })) return false;
+
+  SignalCommand join(SIGNAL_JOIN_CHANNEL, a.name_);
+  *payload += Send(b, join, binary);
+
+  if (!a.Wait([&] { return !a.offer_to_.empty(); })) return false;
+
+  SignalCommand offer(SIGNAL_OFFER_SDP, b.name_);
+  offer.sdp_ = maker.Sdp(true);
+  *payload += Send(a, offer, binary);
+
+  for (size_t i = 0; i < kCandidates; ++i) {
+    SignalCommand candidate(SIGNAL_ICE_CANDIDATE, b.name_);
+    candidate.candidates_.push_back(maker.Candidate(i));
+    *payload += Send(a, candidate, binary);
+  }
+
+  if (!b.Wait([&] { return !b.sdp_.empty(); })) return false;
+
+  SignalCommand answer(SIGNAL_ANSWER_SDP, a.name_);
+  answer.sdp_ = maker.Sdp(false);
+  *payload += Send(b, answer, binary);
+
+  for (size_t i = 0; i < kCandidates; ++i) {
+    SignalCommand candidate(SIGNAL_ICE_CANDIDATE, a.name_);
+    candidate.candidates_.push_back(maker.Candidate(i));
+    *payload += Send(b, candidate, binary);
+  }
+
+  return a.Wait([&] { return !a.sdp_.empty() && a.candidates_ == kCandidates; }) &&
+         b.Wait([&] { return b.candidates_ == kCandidates; });
+}
+
+Result RunBenchmark(const string& url, const Options& options, bool binary,
+                    const Compression& compression) {
+  // Channels of a closed client may not be removed yet, so every client
+  // of the run has a name of its own
+  static size_t clients = 0;
+
+  Result result;
+  SdpMaker maker;
+
+  for (size_t i = 0; i < options.setups_; ++i) {
+    Client a(url, "bench" + to_string(clients++));
+    Client b(url, "bench" + to_string(clients++));
+
+    for (Client* client : { &a, &b }) {
+      client->signal_.set_reconnect_attempts(0);
+      client->signal_.set_binary(binary);
+      client->signal_.set_compression(compression.setting_);
+    }
+
+    Sample start = Sample::Now();
+    a.signal_.Open("bench", "");
+    b.signal_.Open("bench", "");
+
+    if (!a.Wait([&] { return a.opened_; }) || !b.Wait([&] { return b.opened_; })) {
+      return result;
+    }
+
+    Sample connected = Sample::Now();
+    connected.AddTo(start, &result.connect_);
+
+    // The open commands were sent before the exchange
+    size_t payload = 0;
+    if (!Exchange(a, b, maker, binary, &payload)) {
+      return result;
+    }
+
+    Sample::Now().AddTo(connected, &result.exchange_);
+    result.payload_bytes_ += payload;
+    result.compressed_ = a.signal_.compression_opened() && b.signal_.compression_opened();
+
+    a.signal_.SyncClose();
+    b.signal_.SyncClose();
+  }
+
+  result.ok_ = true;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseArgs(argc, argv, options) || options.setups_ == 0) {
+    return 1;
+  }
+
+  peerapi::SignalServer server;
+  if (!server.Start(0, PEERAPI_BENCH_CERTIFICATE)) {
+    cerr << "Failed to start signal server" << endl;
+    return 1;
+  }
+
+  printf("%8s %10s %10s %12s %12s %12s %12s %12s %12s\n",
+         "encoding", "compress", "payload_B", "exchange_B", "exchange_ms", "exchange_cpu",
+         "connect_B", "connect_ms", "connect_cpu");
+
+  int failed = 0;
+
+  for (const string& encoding : options.encodings_) {
+    for (const string& name : options.compressions_) {
+      Compression compression;
+      if (!FindCompression(name, &compression)) {
+        cerr << "Unknown compression: " << name << endl;
+        return 1;
+      }
+
+      Result result = RunBenchmark(server.local_url(), options, encoding == "binary", compression);
+      const double setups = static_cast<double>(options.setups_);
+
+      if (!result.ok_) {
+        printf("%8s %10s %10s\n", encoding.c_str(), name.c_str(), "FAILED");
+        ++failed;
+        continue;
+      }
+
+      if (compression.setting_.enabled_ && !result.compressed_) {
+        printf("%8s %10s %10s\n", encoding.c_str(), name.c_str(), "NO ZLIB");
+        continue;
+      }
+
+      printf("%8s %10s %10.0f %12.0f %12.2f %12.2f %12.0f %12.2f %12.2f\n",
+             encoding.c_str(), name.c_str(),
+             result.payload_bytes_ / setups,
+             result.exchange_.wire_bytes_ / setups,
+             result.exchange_.wall_ms_ / setups,
+             result.exchange_.cpu_ms_ / setups,
+             result.connect_.wire_bytes_ / setups,
+             result.connect_.wall_ms_ / setups,
+             result.connect_.cpu_ms_ / setups);
+      fflush(stdout);
+    }
+  }
+
+  server.Stop();
+  return failed == 0 ? 0 : 1;
+}
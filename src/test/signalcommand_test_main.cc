@@ -0,0 +1,305 @@
+/*
+*  Copyright 2016 The PeerApi Project Authors. All rights reserved.
+*
+*  Ryan Lee
+*/
+
+//
+// signalcommand_test
+//
+// Checks that the JSON and the binary encodings of signaling commands read
+// back what they wrote, that members of an unexpected type are read as
+// rtc::Get*FromJsonObject() read them, that truncated or corrupted input is
+// rejected without reading past its end, and that a binary command does not
+// unpack beyond SIGNAL_MAX_UNPACKED_SIZE. Only the codec is built in, so the
+// test needs no WebRTC.
+//
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "signalcommand.h"
+
+using namespace std;
+using namespace peerapi;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                  \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+                   #condition);                                           \
+      ++failures;                                                         \
+    }                                                                     \
+  } while (0)
+
+static const char kOfferSdp[] =
+  "v=0\r\n"
+  "o=- 4323299364414463285 2 IN IP4 127.0.0.1\r\n"
+  "s=-\r\n"
+  "t=0 0\r\n"
+  "a=group:BUNDLE data\r\n"
+  "a=msid-semantic: WMS\r\n"
+  "m=application 9 DTLS/SCTP 5000\r\n"
+  "c=IN IP4 0.0.0.0\r\n"
+  "a=ice-ufrag:W2Tx\r\n"
+  "a=ice-pwd:2eDyZ3pF1WA/x9Uv2u2aJfkV\r\n"
+  "a=ice-options:trickle\r\n"
+  "a=fingerprint:sha-256 6B:8B:5F:2A:D4:7E:1C:4F:A0:33:55:B6:19:0E:7C:2D:"
+  "8A:61:47:3C:F9:02:AE:15:D0:88:3B:C4:71:6E:59:20\r\n"
+  "a=setup:actpass\r\n"
+  "a=mid:data\r\n"
+  "a=sctpmap:5000 webrtc-datachannel 1024\r\n";
+
+static const char kCandidate[] =
+  "candidate:842163049 1 udp 1677729535 203.0.113.7 61665 typ srflx "
+  "raddr 192.168.0.4 rport 61665 generation 0 ufrag W2Tx network-cost 10";
+
+static bool Equal(const SignalCommand& a, const SignalCommand& b) {
+  if (a.candidates_.size() != b.candidates_.size()) return false;
+  for (size_t i = 0; i < a.candidates_.size(); ++i) {
+    if (a.candidates_[i].sdp_mid_ != b.candidates_[i].sdp_mid_ ||
+        a.candidates_[i].sdp_mline_index_ != b.candidates_[i].sdp_mline_index_ ||
+        a.candidates_[i].candidate_ != b.candidates_[i].candidate_) {
+      return false;
+    }
+  }
+
+  return a.type_ == b.type_ && a.channel_ == b.channel_ && a.peer_id_ == b.peer_id_ &&
+         a.result_ == b.result_ && a.user_id_ == b.user_id_ &&
+         a.user_password_ == b.user_password_ && a.session_id_ == b.session_id_ &&
+         a.name_ == b.name_ && a.desc_ == b.desc_ && a.sdp_ == b.sdp_ &&
+         a.peers_ == b.peers_;
+}
+
+static vector<SignalCommand> SampleCommands() {
+  vector<SignalCommand> commands;
+
+  SignalCommand open(SIGNAL_OPEN);
+  open.user_id_ = "user";
+  open.user_password_ = "pass\"word\\\n";
+  commands.push_back(open);
+
+  SignalCommand opened(SIGNAL_OPEN);
+  opened.result_ = true;
+  opened.session_id_ = "3f1c0a52-6a4e-4b8e-9b7e-0f9d1f6c2a10";
+  commands.push_back(opened);
+
+  SignalCommand create(SIGNAL_CREATE_CHANNEL);
+  create.name_ = "channel \xEC\x95\x88\xEB\x85\x95 \x01";
+  commands.push_back(create);
+
+  SignalCommand created(SIGNAL_CHANNEL_CREATE);
+  created.result_ = false;
+  created.name_ = "channel";
+  created.desc_ = "Channel already exists";
+  commands.push_back(created);
+
+  SignalCommand offer(SIGNAL_CREATE_OFFER);
+  offer.peers_ = { "peer-1", "peer-2", "peer-3" };
+  commands.push_back(offer);
+
+  SignalCommand offer_sdp(SIGNAL_OFFER_SDP, "channel");
+  offer_sdp.peer_id_ = "peer-1";
+  offer_sdp.sdp_ = kOfferSdp;
+  commands.push_back(offer_sdp);
+
+  SignalCommand candidate(SIGNAL_ICE_CANDIDATE, "channel");
+  candidate.peer_id_ = "peer-2";
+  candidate.candidates_.push_back({ "data", 0, kCandidate });
+  commands.push_back(candidate);
+
+  SignalCommand candidates(SIGNAL_ICE_CANDIDATE, "channel");
+  candidates.peer_id_ = "peer-3";
+  candidates.candidates_.push_back({ "data", 0, kCandidate });
+  candidates.candidates_.push_back({ "0", 1, "candidate:1 1 tcp 1 10.0.0.1 9 typ host tcptype active" });
+  candidates.candidates_.push_back({ "", -1, "" });
+  commands.push_back(candidates);
+
+  return commands;
+}
+
+static void test_round_trip() {
+  for (const auto& command : SampleCommands()) {
+    string text;
+    SignalCommand read;
+    EncodeSignalCommand(command, &text);
+    CHECK(DecodeSignalCommand(text.data(), text.size(), &read));
+    CHECK(Equal(command, read));
+
+    string binary;
+    EncodeSignalCommandBinary(command, &binary);
+    CHECK(DecodeSignalCommandBinary(binary.data(), binary.size(), &read));
+    CHECK(Equal(command, read));
+  }
+}
+
+static bool Decode(const string& text, SignalCommand* command) {
+  return DecodeSignalCommand(text.data(), text.size(), command);
+}
+
+static void test_mistyped_members() {
+  SignalCommand command;
+
+  CHECK(Decode("{\"command\":\"channelcreate\",\"data\":{\"result\":\"true\",\"desc\":null,"
+               "\"name\":\"channel\"}}", &command));
+  CHECK(command.result_ && command.desc_.empty() && command.name_ == "channel");
+
+  CHECK(Decode("{\"command\":\"channeljoin\",\"data\":{\"result\":1,\"desc\":{\"a\":[1]}}}",
+               &command));
+  CHECK(command.result_ && command.desc_.empty());
+
+  CHECK(Decode("{\"command\":\"offersdp\",\"peer_id\":12345,\"channel\":true,"
+               "\"data\":{\"sdp\":\"v=0\"}}", &command));
+  CHECK(command.peer_id_ == "12345" && command.channel_ == "true" && command.sdp_ == "v=0");
+
+  CHECK(Decode("{\"command\":\"ice_candidate\",\"data\":{\"sdp_mid\":\"data\","
+               "\"sdp_mline_index\":0.0,\"candidate\":\"candidate:1\"}}", &command));
+  CHECK(command.candidates_.size() == 1 && command.candidates_[0].sdp_mline_index_ == 0);
+
+  CHECK(Decode("{\"command\":\"ice_candidate\",\"data\":{\"candidates\":["
+               "{\"sdp_mline_index\":\"2\"},{\"sdp_mline_index\":1e0},"
+               "{\"sdp_mline_index\":1.5},{\"sdp_mline_index\":1e400},null]}}", &command));
+  CHECK(command.candidates_.size() == 4);
+  if (command.candidates_.size() == 4) {
+    CHECK(command.candidates_[0].sdp_mline_index_ == 2);
+    CHECK(command.candidates_[1].sdp_mline_index_ == 1);
+    CHECK(command.candidates_[2].sdp_mline_index_ == 0);
+    CHECK(command.candidates_[3].sdp_mline_index_ == 0);
+  }
+
+  CHECK(Decode("{\"command\":\"createoffer\",\"data\":{\"peers\":[\"a\",null,7]}}", &command));
+  CHECK((command.peers_ == vector<string>{ "a", "7" }));
+
+  CHECK(Decode("{\"command\":\"createoffer\",\"data\":{\"peers\":\"a\"}}", &command));
+  CHECK(command.peers_.empty());
+
+  CHECK(Decode("{\"command\":\"open\",\"data\":null}", &command));
+  CHECK(command.type_ == SIGNAL_OPEN);
+}
+
+static void test_malformed() {
+  SignalCommand command;
+
+  CHECK(!Decode("", &command));
+  CHECK(!Decode("[]", &command));
+  CHECK(!Decode("{\"data\":{}}", &command));
+  CHECK(!Decode("{\"command\":7}", &command));
+  CHECK(!Decode("{\"command\":\"open\"} x", &command));
+  CHECK(!Decode("{\"command\":\"open\",\"data\":{\"name\":\"\\ud800\"}}", &command));
+  CHECK(!Decode("{\"command\":\"open\",\"data\":{\"name\":\"a\x01\"}}", &command));
+  CHECK(!Decode("{\"command\":\"open\",\"data\":{\"result\":tru}}", &command));
+  CHECK(!Decode("{\"command\":\"open\",\"data\":{\"result\":x}}", &command));
+  CHECK(!Decode("{\"command\":\"open\",\"x\":" + string(1000, '[') + string(1000, ']') + "}",
+                &command));
+
+  // Every prefix of a valid command is rejected, and corrupted bytes are
+  // rejected or read without running past the end
+  mt19937 random(1);
+  for (const auto& sample : SampleCommands()) {
+    string text;
+    string binary;
+    EncodeSignalCommand(sample, &text);
+    EncodeSignalCommandBinary(sample, &binary);
+
+    for (size_t size = 0; size < text.size(); ++size) {
+      string prefix(text, 0, size);
+      CHECK(!DecodeSignalCommand(prefix.data(), prefix.size(), &command));
+    }
+
+    for (size_t size = 0; size < binary.size(); ++size) {
+      // A copy of its own size, so that a read past the end is caught by
+      // address sanitizer
+      vector<char> prefix(binary.begin(), binary.begin() + size);
+      DecodeSignalCommandBinary(prefix.data(), prefix.size(), &command);
+    }
+
+    for (int i = 0; i < 2000; ++i) {
+      vector<char> corrupt(text.begin(), text.end());
+      vector<char> corrupt_binary(binary.begin(), binary.end());
+      for (int j = 0; j < 4; ++j) {
+        corrupt[random() % corrupt.size()] = static_cast<char>(random());
+        corrupt_binary[random() % corrupt_binary.size()] = static_cast<char>(random());
+      }
+      DecodeSignalCommand(corrupt.data(), corrupt.size(), &command);
+      DecodeSignalCommandBinary(corrupt_binary.data(), corrupt_binary.size(), &command);
+    }
+  }
+}
+
+static void AppendVarint(string* out, size_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// A binary 'offersdp' of |lines| packed lines of one byte each, or an
+// 'ice_candidate' with |candidates| candidates of these lines
+static string PackedCommand(size_t lines, size_t candidates) {
+  const char kLongestLine = 9;    // "m=application 9 UDP/DTLS/SCTP webrtc-datachannel"
+  const char kSdpTag = 9;
+  const char kCandidateTag = 10;
+  const char kCandidateLineTag = 3;
+
+  string packed(lines, kLongestLine);
+  string command(1, static_cast<char>(candidates > 0 ? SIGNAL_ICE_CANDIDATE : SIGNAL_OFFER_SDP));
+
+  if (candidates == 0) {
+    command.push_back(kSdpTag);
+    AppendVarint(&command, packed.size());
+    command.append(packed);
+    return command;
+  }
+
+  string candidate(1, kCandidateLineTag);
+  AppendVarint(&candidate, packed.size());
+  candidate.append(packed);
+
+  for (size_t i = 0; i < candidates; ++i) {
+    command.push_back(kCandidateTag);
+    AppendVarint(&command, candidate.size());
+    command.append(candidate);
+  }
+  return command;
+}
+
+static void test_unpacked_size() {
+  SignalCommand command;
+
+  string small = PackedCommand(100, 0);
+  CHECK(DecodeSignalCommandBinary(small.data(), small.size(), &command));
+  CHECK(command.sdp_.size() > 100 * 40);
+
+  // A line of about 50 bytes from each byte of the message
+  string large = PackedCommand(SIGNAL_MAX_UNPACKED_SIZE / 10, 0);
+  CHECK(large.size() < SIGNAL_MAX_MESSAGE_SIZE);
+  CHECK(!DecodeSignalCommandBinary(large.data(), large.size(), &command));
+
+  // Candidates below the limit each, but not together
+  string candidates = PackedCommand(SIGNAL_MAX_UNPACKED_SIZE / 200, 20);
+  CHECK(!DecodeSignalCommandBinary(candidates.data(), candidates.size(), &command));
+
+  string candidate = PackedCommand(SIGNAL_MAX_UNPACKED_SIZE / 200, 1);
+  CHECK(DecodeSignalCommandBinary(candidate.data(), candidate.size(), &command));
+  CHECK(command.candidates_.size() == 1);
+}
+
+int main() {
+  test_round_trip();
+  test_mistyped_members();
+  test_malformed();
+  test_unpacked_size();
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+
+  std::printf("Passed\n");
+  return 0;
+}